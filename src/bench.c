@@ -0,0 +1,533 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "bulk.h"
+
+#define LOAD_BALANCER_PORT 9090 // Port for the load balancer
+#define MAX_BUFFER_SIZE 80      // Maximum buffer size for reading from the socket
+#define MAX_THREADS 64          // Maximum number of benchmark threads
+#define MAX_WINDOW 256          // Maximum number of outstanding UDP requests per thread
+#define UDP_TIMEOUT 0.2         // Time to wait for a UDP reply before retransmitting, in seconds
+#define UDP_ATTEMPTS 5          // Number of times a UDP request is sent
+
+int REQUESTS = 1000;     // Number of requests (or handshakes) per phase
+int THREADS = 1;         // Number of concurrent benchmark threads
+int FIRST_CLIENT_ID = 1; // Client ID of the first benchmark thread
+int UDP = 0;             // Flag to send requests over the UDP fast path
+int WINDOW = 1;          // Number of outstanding UDP requests per thread
+int STREAM = 0;          // Flag to send one bulk request of BULK_MAX_VALUES values per connection
+SSL_CTX *TLS_CTX = NULL; // TLS context, NULL for plaintext
+
+// Per-thread benchmark state
+struct worker
+{
+    int client_id;         // Client ID used in the requests
+    int resume;            // Flag to reuse the TLS session of the previous connection
+    int count;             // Number of connections to make
+    int failed;            // Number of failed connections
+    int reused;            // Number of resumed TLS sessions
+    int retransmits;       // Number of retransmitted UDP requests
+    int handshakes;        // Number of completed TLS handshakes
+    double handshake_time; // Time spent in TLS handshakes, in seconds
+    double bytes;          // Bytes of bulk requests and results transferred
+    int ktls;              // Number of connections whose records were encrypted by the kernel
+    SSL_SESSION *session;  // TLS session used for resumption
+};
+
+// Outstanding UDP request
+struct udp_slot
+{
+    uint64_t id;  // Request ID, 0 if the slot is free
+    double sent;  // Time of the last transmission
+    int attempts; // Number of transmissions
+};
+
+double now();
+int is_result(const char *, ssize_t);
+int connect_to_lb();
+int run_connection(struct worker *);
+int run_stream(struct worker *, SSL *, int);
+void *run_worker(void *);
+void run_udp_worker(struct worker *);
+double busy_cores();
+double run_phase(const char *, int);
+void usage(const char *);
+
+int main(int argc, char *argv[])
+{
+    // Ignore SIGPIPE so that a closed connection is counted as a failure
+    signal(SIGPIPE, SIG_IGN);
+
+    // Parse benchmark options
+    const char *ca_file = NULL;
+    int option;
+    while ((option = getopt(argc, argv, "t:n:j:c:uw:")) != -1)
+    {
+        switch (option)
+        {
+        case 't':
+            ca_file = optarg;
+            break;
+        case 'n':
+            REQUESTS = atoi(optarg);
+            break;
+        case 'j':
+            THREADS = atoi(optarg);
+            break;
+        case 'c':
+            FIRST_CLIENT_ID = atoi(optarg);
+            break;
+        case 'u':
+            UDP = 1;
+            break;
+        case 'w':
+            WINDOW = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc || REQUESTS <= 0 || THREADS <= 0 || THREADS > MAX_THREADS || WINDOW <= 0 || WINDOW > MAX_WINDOW || (UDP && ca_file != NULL))
+    {
+        usage(argv[0]);
+    }
+    const char *mode = argv[optind];
+
+    // Set up a TLS client that trusts the load balancer certificate
+    if (ca_file != NULL)
+    {
+        TLS_CTX = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_verify(TLS_CTX, SSL_VERIFY_PEER, NULL);
+        SSL_CTX_set_session_cache_mode(TLS_CTX, SSL_SESS_CACHE_CLIENT);
+        SSL_CTX_set_options(TLS_CTX, SSL_OP_ENABLE_KTLS);
+        if (SSL_CTX_load_verify_locations(TLS_CTX, ca_file, NULL) <= 0)
+        {
+            ERR_print_errors_fp(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strcmp(mode, "handshake") == 0)
+    {
+        // Compare full and resumed handshakes; each connection carries one request because TLS 1.3 tickets only arrive after the handshake
+        if (TLS_CTX == NULL)
+        {
+            fprintf(stderr, "Handshake mode needs a CA certificate (-t).\n");
+            exit(EXIT_FAILURE);
+        }
+        run_phase("connections with full handshakes", 0);
+        run_phase("connections with resumed handshakes", 1);
+    }
+    else if (strcmp(mode, "throughput") == 0)
+    {
+        // Send requests through the whole system, resuming TLS sessions between them
+        run_phase(UDP ? "UDP requests" : TLS_CTX != NULL ? "TLS requests" : "plaintext requests", 1);
+    }
+    else if (strcmp(mode, "stream") == 0 && !UDP)
+    {
+        // Push large bulk requests through long-lived connections, where kernel TLS makes its difference
+        STREAM = 1;
+        run_phase(TLS_CTX != NULL ? "TLS bulk requests" : "plaintext bulk requests", 1);
+    }
+    else
+    {
+        usage(argv[0]);
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+double now()
+{
+    // Monotonic time in seconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int is_result(const char *buffer, ssize_t length)
+{
+    // A reply is a square root; statuses such as -2 (over the rate limit) count as failures
+    return length > 0 && buffer[0] >= '0' && buffer[0] <= '9';
+}
+
+int connect_to_lb()
+{
+    // Create a socket and connect to the load balancer
+    struct sockaddr_in serv_addr;
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_fd < 0)
+    {
+        return -1;
+    }
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(LOAD_BALANCER_PORT);
+
+    // Disable Nagle's algorithm so that small handshake messages are not delayed
+    int opt = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr);
+    if (connect(client_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        close(client_fd);
+        return -1;
+    }
+    return client_fd;
+}
+
+int run_connection(struct worker *w)
+{
+    int client_fd = connect_to_lb();
+    if (client_fd < 0)
+    {
+        return -1;
+    }
+
+    // Prepare the request
+    char request[MAX_BUFFER_SIZE];
+    char buffer[MAX_BUFFER_SIZE];
+    snprintf(request, sizeof(request), "%d 2", w->client_id);
+    ssize_t byte_length = 0;
+
+    if (TLS_CTX == NULL && STREAM)
+    {
+        // Plaintext bulk request
+        int ok = run_stream(w, NULL, client_fd) == 0;
+        close(client_fd);
+        return ok ? 0 : -1;
+    }
+    if (TLS_CTX == NULL)
+    {
+        // Plaintext request
+        send(client_fd, request, strlen(request), 0);
+        byte_length = read(client_fd, buffer, MAX_BUFFER_SIZE - 1);
+        close(client_fd);
+        return is_result(buffer, byte_length) ? 0 : -1;
+    }
+
+    // TLS handshake, resuming the previous session if requested
+    SSL *ssl = SSL_new(TLS_CTX);
+    SSL_set_tlsext_host_name(ssl, "localhost");
+    SSL_set1_host(ssl, "localhost");
+    SSL_set_fd(ssl, client_fd);
+    if (w->resume && w->session != NULL)
+    {
+        SSL_set_session(ssl, w->session);
+    }
+    double handshake_start = now();
+    int ok = SSL_connect(ssl) > 0;
+    if (ok)
+    {
+        // Time the handshake alone, without the request through the proxies and servers
+        w->handshake_time += now() - handshake_start;
+        w->handshakes++;
+    }
+    if (ok && SSL_session_reused(ssl))
+    {
+        w->reused++;
+    }
+
+    // Send the request
+    if (ok && STREAM)
+    {
+        ok = run_stream(w, ssl, client_fd) == 0;
+    }
+    else if (ok)
+    {
+        ok = SSL_write(ssl, request, strlen(request)) > 0 && is_result(buffer, SSL_read(ssl, buffer, MAX_BUFFER_SIZE - 1));
+    }
+    if (ok)
+    {
+        SSL_shutdown(ssl);
+    }
+
+    // Keep the newest session for the next connection; TLS 1.3 tickets are single-use
+    if (ok && w->resume)
+    {
+        SSL_SESSION *session = SSL_get1_session(ssl);
+        if (session != NULL && SSL_SESSION_is_resumable(session))
+        {
+            SSL_SESSION_free(w->session);
+            w->session = session;
+        }
+        else
+        {
+            SSL_SESSION_free(session);
+        }
+    }
+    SSL_free(ssl);
+    close(client_fd);
+    return ok ? 0 : -1;
+}
+
+int run_stream(struct worker *w, SSL *ssl, int client_fd)
+{
+    // Send a bulk request of fours, which the load balancer relays in chunks
+    size_t size = (size_t)BULK_MAX_VALUES * sizeof(uint32_t);
+    uint32_t *values = (uint32_t *)malloc(size);
+    float four = 4;
+    float two = 2;
+    uint32_t bits;
+    uint32_t expected;
+    memcpy(&bits, &four, sizeof(bits));
+    memcpy(&expected, &two, sizeof(expected));
+    for (int i = 0; i < BULK_MAX_VALUES; i++)
+    {
+        values[i] = htonl(bits);
+    }
+    char header[MAX_BUFFER_SIZE];
+    int header_length = snprintf(header, sizeof(header), "%d B %d\n", w->client_id, BULK_MAX_VALUES);
+    int ok = ssl != NULL ? SSL_write(ssl, header, header_length) > 0 && SSL_write(ssl, values, size) > 0
+                         : send_all(client_fd, header, header_length) == 0 && send_all(client_fd, values, size) == 0;
+
+    // Read the square roots back
+    size_t received = 0;
+    while (ok && received < size)
+    {
+        ssize_t n = ssl != NULL ? SSL_read(ssl, (char *)values + received, size - received) : read(client_fd, (char *)values + received, size - received);
+        ok = n > 0;
+        received += ok ? n : 0;
+    }
+    ok = ok && values[0] == htonl(expected) && values[BULK_MAX_VALUES - 1] == htonl(expected);
+    if (ok)
+    {
+        w->bytes += header_length + 2.0 * size;
+
+        // Note whether the kernel encrypted the records; it is used with the same cipher on both ends of the connection
+        if (ssl != NULL && BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+        {
+            w->ktls++;
+        }
+    }
+    free(values);
+    return ok ? 0 : -1;
+}
+
+void *run_worker(void *arg)
+{
+    // Make the connections of this thread
+    struct worker *w = (struct worker *)arg;
+    if (UDP)
+    {
+        run_udp_worker(w);
+        return NULL;
+    }
+    for (int i = 0; i < w->count; i++)
+    {
+        if (run_connection(w) < 0)
+        {
+            w->failed++;
+        }
+    }
+    return NULL;
+}
+
+void run_udp_worker(struct worker *w)
+{
+    // Create a UDP socket for the load balancer
+    int client_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in lb_addr;
+    memset(&lb_addr, 0, sizeof(lb_addr));
+    lb_addr.sin_family = AF_INET;
+    lb_addr.sin_port = htons(LOAD_BALANCER_PORT);
+    inet_pton(AF_INET, "127.0.0.1", &lb_addr.sin_addr);
+
+    // Keep up to WINDOW requests outstanding; the slot of a request is its ID modulo WINDOW
+    struct udp_slot slots[MAX_WINDOW];
+    memset(slots, 0, sizeof(slots));
+    uint64_t next_id = 0;
+    int issued = 0;
+    int done = 0;
+    char request[MAX_BUFFER_SIZE];
+    char buffer[MAX_BUFFER_SIZE];
+    for (int i = 0; i < WINDOW && issued < w->count; i++, issued++)
+    {
+        slots[i].id = ++next_id * WINDOW + i;
+        slots[i].sent = now();
+        slots[i].attempts = 1;
+        snprintf(request, sizeof(request), "%llu %d 2", (unsigned long long)slots[i].id, w->client_id);
+        sendto(client_fd, request, strlen(request), 0, (struct sockaddr *)&lb_addr, sizeof(lb_addr));
+    }
+
+    while (done < w->count)
+    {
+        // Collect the replies that arrived and reuse their slots for new requests
+        struct pollfd pfd = {client_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, (int)(UDP_TIMEOUT * 1000 / 4));
+        while (ready > 0)
+        {
+            ssize_t byte_length = recv(client_fd, buffer, MAX_BUFFER_SIZE - 1, MSG_DONTWAIT);
+            if (byte_length <= 0)
+            {
+                break;
+            }
+            buffer[byte_length] = '\0';
+            char *result;
+            uint64_t id = strtoull(buffer, &result, 10);
+            struct udp_slot *slot = &slots[id % WINDOW];
+            if (id == 0 || slot->id != id)
+            {
+                continue;
+            }
+            done++;
+            while (*result == ' ')
+            {
+                result++;
+            }
+            if (!is_result(result, strlen(result)))
+            {
+                w->failed++;
+            }
+            slot->id = 0;
+            if (issued < w->count)
+            {
+                issued++;
+                slot->id = ++next_id * WINDOW + id % WINDOW;
+                slot->sent = now();
+                slot->attempts = 1;
+                snprintf(request, sizeof(request), "%llu %d 2", (unsigned long long)slot->id, w->client_id);
+                sendto(client_fd, request, strlen(request), 0, (struct sockaddr *)&lb_addr, sizeof(lb_addr));
+            }
+        }
+
+        // Retransmit requests whose reply is late, and give up after UDP_ATTEMPTS
+        double current = now();
+        for (int i = 0; i < WINDOW; i++)
+        {
+            if (slots[i].id == 0 || current - slots[i].sent < UDP_TIMEOUT)
+            {
+                continue;
+            }
+            if (slots[i].attempts == UDP_ATTEMPTS)
+            {
+                w->failed++;
+                done++;
+                slots[i].id = 0;
+                continue;
+            }
+            slots[i].sent = current;
+            slots[i].attempts++;
+            w->retransmits++;
+            snprintf(request, sizeof(request), "%llu %d 2", (unsigned long long)slots[i].id, w->client_id);
+            sendto(client_fd, request, strlen(request), 0, (struct sockaddr *)&lb_addr, sizeof(lb_addr));
+        }
+    }
+    close(client_fd);
+}
+
+double busy_cores()
+{
+    // Busy CPU time of the whole machine in seconds, from /proc/stat
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    FILE *file = fopen("/proc/stat", "r");
+    if (file == NULL || fscanf(file, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) != 8)
+    {
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        return 0;
+    }
+    fclose(file);
+    return (double)(user + nice + system + irq + softirq + steal) / sysconf(_SC_CLK_TCK);
+}
+
+double run_phase(const char *name, int resume)
+{
+    struct worker workers[MAX_THREADS];
+    pthread_t thread_ids[MAX_THREADS];
+
+    // Prepare the threads; a session is fetched beforehand so that resumption starts immediately
+    for (int i = 0; i < THREADS; i++)
+    {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].client_id = FIRST_CLIENT_ID + i;
+        workers[i].resume = resume;
+        workers[i].count = REQUESTS / THREADS + (i < REQUESTS % THREADS);
+        if (resume && TLS_CTX != NULL)
+        {
+            run_connection(&workers[i]);
+            workers[i].reused = 0;
+            workers[i].handshakes = 0;
+            workers[i].handshake_time = 0;
+            workers[i].bytes = 0;
+            workers[i].ktls = 0;
+        }
+    }
+
+    // Run the threads and measure the elapsed and busy CPU time
+    double start = now();
+    double start_busy = busy_cores();
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_create(&thread_ids[i], NULL, run_worker, &workers[i]);
+    }
+    int failed = 0;
+    int reused = 0;
+    int retransmits = 0;
+    int handshakes = 0;
+    double handshake_time = 0;
+    double bytes = 0;
+    int ktls = 0;
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(thread_ids[i], NULL);
+        failed += workers[i].failed;
+        reused += workers[i].reused;
+        retransmits += workers[i].retransmits;
+        handshakes += workers[i].handshakes;
+        handshake_time += workers[i].handshake_time;
+        bytes += workers[i].bytes;
+        ktls += workers[i].ktls;
+        SSL_SESSION_free(workers[i].session);
+    }
+    double elapsed = now() - start;
+    double cores = (busy_cores() - start_busy) / elapsed;
+
+    // Report the rate of successful connections, also per busy core of the machine (benchmark included)
+    double rate = (REQUESTS - failed) / elapsed;
+    printf("[BENCH]: %d %s in %.3f s with %d thread(s): %.0f/s, %.1f us each, %d failed", REQUESTS, name, elapsed, THREADS, rate, 1e6 * elapsed * THREADS / REQUESTS, failed);
+    if (cores > 0)
+    {
+        printf(", %.2f busy cores, %.0f/s per core", cores, rate / cores);
+    }
+    if (TLS_CTX != NULL)
+    {
+        printf(", %d resumed", reused);
+    }
+    if (STREAM)
+    {
+        printf(", %.1f MB/s", bytes / elapsed / 1e6);
+        if (TLS_CTX != NULL)
+        {
+            printf(", kernel TLS on %d of %d connections", ktls, REQUESTS - failed);
+        }
+    }
+    if (handshakes > 0 && !STREAM)
+    {
+        // Handshake rate if the threads did nothing but handshakes
+        printf(", handshake %.1f us each, %.0f handshakes/s", 1e6 * handshake_time / handshakes, handshakes * THREADS / handshake_time);
+    }
+    if (UDP)
+    {
+        printf(", %d retransmitted", retransmits);
+    }
+    printf("\n");
+    return rate;
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-t ca_cert | -u [-w window]] [-n count] [-j threads] [-c client_id] handshake|throughput|stream\n", program);
+    exit(EXIT_FAILURE);
+}
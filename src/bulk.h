@@ -0,0 +1,117 @@
+// Bulk request wire format shared by the client, load balancer, reverse proxies and servers.
+//
+// A bulk request is the text header "<client_id> B <count>\n" (with an optional
+// trace token before the newline) followed by count floats as network-order
+// 32-bit words. The reply is count floats in the same encoding.
+#ifndef BULK_H
+#define BULK_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define BULK_MAX_VALUES (1 << 20) // Maximum number of values in a bulk request
+#define BULK_HEADER_SIZE 80       // Maximum length of a bulk request header
+
+static inline ssize_t bulk_parse_header(const char *buffer, ssize_t byte_length, int *count, const char *tier)
+{
+    // Length of the header, 0 if the buffer does not start with one, -1 if it is invalid
+    const char *end = memchr(buffer, '\n', byte_length);
+    if (end == NULL || end - buffer >= BULK_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    // Copy the header to parse it as a string
+    char header[BULK_HEADER_SIZE];
+    memcpy(header, buffer, end - buffer);
+    header[end - buffer] = '\0';
+    int client_id;
+    char type;
+    if (sscanf(header, "%d %c %d", &client_id, &type, count) != 3 || type != 'B')
+    {
+        return 0;
+    }
+
+    // Reject bulk requests of invalid size
+    if (*count <= 0 || *count > BULK_MAX_VALUES)
+    {
+        printf("[%s]: Invalid bulk request of %d values from Client #%d.\n", tier, *count, client_id);
+        return -1;
+    }
+    return end - buffer + 1;
+}
+
+static inline int send_all(int fd, const void *buffer, size_t length)
+{
+    // Send until the whole buffer is written
+    const char *data = (const char *)buffer;
+    while (length > 0)
+    {
+        ssize_t n = send(fd, data, length, 0);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static inline int recv_all(int fd, void *buffer, size_t length)
+{
+    // Read until the whole buffer is filled
+    char *data = (char *)buffer;
+    while (length > 0)
+    {
+        ssize_t n = read(fd, data, length);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static inline int exchange_all(int fd, const void *out, size_t out_length, void *in, size_t in_length)
+{
+    // Send and receive at the same time so that neither side blocks on a full socket buffer
+    size_t sent = 0;
+    size_t received = 0;
+    while (received < in_length)
+    {
+        struct pollfd pfd = {fd, POLLIN | (sent < out_length ? POLLOUT : 0), 0};
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            return -1;
+        }
+        if ((pfd.revents & POLLOUT) && sent < out_length)
+        {
+            ssize_t n = send(fd, (const char *)out + sent, out_length - sent, MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return -1;
+            }
+            sent += n > 0 ? n : 0;
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            ssize_t n = recv(fd, (char *)in + received, in_length - received, MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                return -1;
+            }
+            received += n > 0 ? n : 0;
+        }
+    }
+    return 0;
+}
+
+#endif
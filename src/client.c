@@ -4,17 +4,89 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <poll.h>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "trace.h"
+#include "bulk.h"
 
 #define LOAD_BALANCER_PORT 9090 // Port for the load balancer
 #define MAX_BUFFER_SIZE 80      // Maximum buffer size for reading from the socket
+#define UDP_TIMEOUT_MS 200        // Time to wait for a UDP reply before retransmitting, doubled on each retry
+#define UDP_ATTEMPTS 5            // Number of times a UDP request is sent
 
-int main(int argc, char const *argv[])
+void send_bulk(SSL *, int, const char *, uint64_t);
+void send_udp(const char *, uint64_t);
+ssize_t lb_read(SSL *, int, void *, size_t);
+int lb_write(SSL *, int, const void *, size_t);
+
+int main(int argc, char *argv[])
 {
+    // Extract the CA certificate of the load balancer if TLS is requested, and the bulk mode flag
+    const char *ca_file = NULL;
+    int bulk = 0;
+    int udp = 0;
+    int option;
+    while ((option = getopt(argc, argv, "t:bu")) != -1)
+    {
+        if (option == 't')
+        {
+            ca_file = optarg;
+        }
+        else if (option == 'b')
+        {
+            bulk = 1;
+        }
+        else if (option == 'u')
+        {
+            udp = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-t ca_cert] [-b] [-u] <client_id>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Extract client ID from command line arguments
-    const char *client_id = argv[1];
+    const char *client_id = argv[optind];
     int status, client_fd;
     struct sockaddr_in serv_addr;
 
+    // Start the trace of the request
+    char trace_name[32];
+    snprintf(trace_name, sizeof(trace_name), "CLIENT #%s", client_id);
+    trace_init(trace_name);
+    uint64_t trace_id = trace_new_id();
+
+    // With a trace directory, keep the client span and pick an ID that every tier keeps too
+    if (getenv("TRACE_DIR") != NULL)
+    {
+        trace_sample = 10000;
+        trace_id = trace_kept_id();
+    }
+    uint64_t start = trace_now();
+
+    // Send the request as a single datagram; the trace ID doubles as the request ID
+    if (udp)
+    {
+        if (bulk || ca_file != NULL)
+        {
+            fprintf(stderr, "UDP mode supports neither bulk requests nor TLS.\n");
+            exit(EXIT_FAILURE);
+        }
+        send_udp(client_id, trace_id);
+        trace_span(trace_id, "client.request_udp", start, atoi(client_id));
+        if (getenv("TRACE_DIR") != NULL)
+        {
+            printf("\tTrace: %016llx\n", (unsigned long long)trace_id);
+            trace_dump();
+        }
+        exit(EXIT_SUCCESS);
+    }
+
     // Create socket file descriptor
     if ((client_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
     {
@@ -40,6 +112,41 @@ int main(int argc, char const *argv[])
         exit(EXIT_FAILURE);
     }
 
+    // Do the TLS handshake and verify the load balancer certificate
+    SSL *ssl = NULL;
+    if (ca_file != NULL)
+    {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+        if (SSL_CTX_load_verify_locations(ctx, ca_file, NULL) <= 0)
+        {
+            ERR_print_errors_fp(stderr);
+            exit(EXIT_FAILURE);
+        }
+        ssl = SSL_new(ctx);
+        SSL_set_tlsext_host_name(ssl, "localhost");
+        SSL_set1_host(ssl, "localhost");
+        SSL_set_fd(ssl, client_fd);
+        if (SSL_connect(ssl) <= 0)
+        {
+            ERR_print_errors_fp(stderr);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Send all values of standard input in a single bulk request
+    if (bulk)
+    {
+        send_bulk(ssl, client_fd, client_id, trace_id);
+        close(client_fd);
+        trace_span(trace_id, "client.request_bulk", start, atoi(client_id));
+        if (getenv("TRACE_DIR") != NULL)
+        {
+            trace_dump();
+        }
+        exit(EXIT_SUCCESS);
+    }
+
     // Inform the user about the client ID and prompt for input
     printf("This is client #%s\nEnter a non-negative float: ", client_id);
 
@@ -61,14 +168,23 @@ int main(int argc, char const *argv[])
     strcat(sendstr, " ");
     strcat(sendstr, str);
 
-    // Send the prepared string to the load balancer
-    send(client_fd, sendstr, strlen(sendstr), 0);
+    // Append the trace ID if it fits; otherwise the load balancer assigns one
+    if (strlen(sendstr) + TRACE_TOKEN_LENGTH < MAX_BUFFER_SIZE - 1)
+    {
+        sprintf(sendstr + strlen(sendstr), " T%016llx", (unsigned long long)trace_id);
+    }
 
     // Buffer to hold the response from the load balancer
     char buffer[MAX_BUFFER_SIZE];
+    ssize_t byte_length;
 
-    // Read the response from the load balancer
-    ssize_t byte_length = read(client_fd, buffer, MAX_BUFFER_SIZE);
+    // Send the prepared string and read the response from the load balancer
+    lb_write(ssl, client_fd, sendstr, strlen(sendstr));
+    byte_length = lb_read(ssl, client_fd, buffer, MAX_BUFFER_SIZE - 1);
+    if (byte_length < 0)
+    {
+        byte_length = 0;
+    }
     buffer[byte_length] = '\0';
 
     // Print the result from the server
@@ -77,6 +193,170 @@ int main(int argc, char const *argv[])
     // Close the socket
     close(client_fd);
 
+    // Record the request span and dump it if a trace directory is set
+    trace_span(trace_id, "client.request", start, atoi(client_id));
+    if (getenv("TRACE_DIR") != NULL)
+    {
+        printf("\tTrace: %016llx\n", (unsigned long long)trace_id);
+        trace_dump();
+    }
+
     // Exit the program successfully
     exit(EXIT_SUCCESS);
 }
+
+void send_bulk(SSL *ssl, int client_fd, const char *client_id, uint64_t trace_id)
+{
+    // Inform the user about the client ID and prompt for input
+    printf("This is client #%s\nEnter non-negative floats, end with Ctrl-D:\n", client_id);
+
+    // Read the values and convert them to network byte order
+    int count = 0;
+    int capacity = 1024;
+    uint32_t *values = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    float value;
+    while (count < BULK_MAX_VALUES && scanf("%f", &value) == 1)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            values = (uint32_t *)realloc(values, capacity * sizeof(uint32_t));
+        }
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        values[count++] = htonl(bits);
+    }
+    if (count == 0)
+    {
+        free(values);
+        return;
+    }
+
+    // Send the length-prefixed header followed by the values; a load balancer that rejects the request stops reading early
+    signal(SIGPIPE, SIG_IGN);
+    char header[MAX_BUFFER_SIZE];
+    int header_length = snprintf(header, sizeof(header), "%s B %d T%016llx\n", client_id, count, (unsigned long long)trace_id);
+    size_t size = (size_t)count * sizeof(uint32_t);
+    int sent = lb_write(ssl, client_fd, header, header_length) == 0 && lb_write(ssl, client_fd, values, size) == 0;
+
+    // Read the results, which come back in the same order as the values
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t n = lb_read(ssl, client_fd, (char *)values + received, size - received);
+        if (n <= 0)
+        {
+            break;
+        }
+        received += n;
+    }
+
+    // A single -2 in place of the results means the load balancer rejected the request over the rate limit
+    if (received == sizeof(uint32_t) && (received < size || !sent))
+    {
+        uint32_t bits = ntohl(values[0]);
+        memcpy(&value, &bits, sizeof(value));
+        if (value == -2)
+        {
+            printf("\tResult: -2 (over the rate limit)\n");
+            free(values);
+            return;
+        }
+    }
+    if (received < size)
+    {
+        fprintf(stderr, sent ? "Connection closed after %zu of %d results\n" : "Sending bulk request failed after %zu of %d results\n", received / sizeof(uint32_t), count);
+        exit(EXIT_FAILURE);
+    }
+
+    // Print the results from the servers
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t bits = ntohl(values[i]);
+        memcpy(&value, &bits, sizeof(value));
+        printf("\tResult: %.2f\n", value);
+    }
+    free(values);
+}
+
+void send_udp(const char *client_id, uint64_t request_id)
+{
+    // Inform the user about the client ID and prompt for input
+    printf("This is client #%s\nEnter a non-negative float: ", client_id);
+    fflush(stdout);
+
+    // Read user input and remove the newline character
+    char str[64];
+    if (fgets(str, 64, stdin) == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    str[strcspn(str, "\n")] = '\0';
+
+    // Create a UDP socket for the load balancer
+    int client_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (client_fd < 0)
+    {
+        perror("\nSocket creation error\n");
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_in lb_addr;
+    memset(&lb_addr, 0, sizeof(lb_addr));
+    lb_addr.sin_family = AF_INET;
+    lb_addr.sin_port = htons(LOAD_BALANCER_PORT);
+    inet_pton(AF_INET, "127.0.0.1", &lb_addr.sin_addr);
+
+    // Prepare the datagram; the trace ID doubles as the request ID and travels as a trace token
+    char request[MAX_BUFFER_SIZE];
+    snprintf(request, sizeof(request), "%llu %s %s T%016llx", (unsigned long long)request_id, client_id, str, (unsigned long long)request_id);
+
+    // Send the datagram and retransmit it until the reply with the same request ID arrives
+    int timeout = UDP_TIMEOUT_MS;
+    for (int attempt = 0; attempt < UDP_ATTEMPTS; attempt++, timeout *= 2)
+    {
+        sendto(client_fd, request, strlen(request), 0, (struct sockaddr *)&lb_addr, sizeof(lb_addr));
+        struct pollfd pfd = {client_fd, POLLIN, 0};
+        while (poll(&pfd, 1, timeout) > 0)
+        {
+            char buffer[MAX_BUFFER_SIZE];
+            ssize_t byte_length = recv(client_fd, buffer, MAX_BUFFER_SIZE - 1, 0);
+            if (byte_length <= 0)
+            {
+                continue;
+            }
+            buffer[byte_length] = '\0';
+
+            // Ignore late replies to other requests
+            char *result;
+            if (strtoull(buffer, &result, 10) == request_id)
+            {
+                printf("\tResult: %s\n", result + strspn(result, " "));
+                close(client_fd);
+                return;
+            }
+        }
+    }
+
+    fprintf(stderr, "No reply after %d attempts\n", UDP_ATTEMPTS);
+    exit(EXIT_FAILURE);
+}
+
+ssize_t lb_read(SSL *ssl, int client_fd, void *buffer, size_t length)
+{
+    // Read from the load balancer, through TLS if enabled
+    if (ssl != NULL)
+    {
+        return SSL_read(ssl, buffer, length);
+    }
+    return read(client_fd, buffer, length);
+}
+
+int lb_write(SSL *ssl, int client_fd, const void *buffer, size_t length)
+{
+    // Write the whole buffer to the load balancer, through TLS if enabled
+    if (ssl != NULL)
+    {
+        return SSL_write(ssl, buffer, length) > 0 ? 0 : -1;
+    }
+    return send_all(client_fd, buffer, length);
+}
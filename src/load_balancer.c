@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,31 +6,153 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <signal.h>
-
-#define MAX_BUFFER_SIZE 80 // Maximum buffer size for reading from the socket
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "trace.h"
+#include "bulk.h"
+#include "udp.h"
+
+#define MAX_BUFFER_SIZE 80           // Maximum buffer size for reading from the socket
+#define BULK_CHUNK_SIZE 65536        // Size of the chunks relayed between client and proxy in a bulk request
+#define TLS_SESSION_CACHE_SIZE 20000 // Number of TLS sessions kept for resumption
+#define RATE_SHARDS 256              // Number of independently locked shards of the rate limit table
+#define RATE_INITIAL_BUCKETS 64      // Initial number of hash buckets per shard
+#define RATE_SWEEP_INTERVAL 10       // Seconds between sweeps for idle clients
+#define RATE_BULK_VALUES 1024        // Number of bulk request values that cost one token
+#define RATE_LIMITED "-2"            // Reply to requests over the rate limit
 
 int LB_PORT;
 int RP_IDS[2];
 int RP_PORTS[2];
+SSL_CTX *TLS_CTX = NULL; // TLS context, NULL if TLS termination is disabled
+int ktls_reported = 0;   // Flag to indicate if the kernel TLS state has been logged
+
+// Token bucket of one client
+struct rate_entry
+{
+    int client_id;
+    double tokens;           // Tokens left, negative while a bulk request is paid off
+    double last;             // Time of the last refill
+    double rate;             // Tokens added per second
+    double burst;            // Maximum number of tokens
+    struct rate_entry *next; // Next entry in the hash bucket
+};
+
+// Shard of the rate limit table, locked independently of the others
+struct rate_shard
+{
+    pthread_mutex_t lock;
+    struct rate_entry **buckets;
+    size_t bucket_count; // Number of buckets, a power of two
+    size_t entry_count;  // Number of clients in the shard
+};
+
+// Rate and burst of a client that differ from the defaults
+struct rate_override
+{
+    int client_id;
+    double rate;
+    double burst;
+};
+
+double RATE_LIMIT = 0;                       // Default tokens per second of a client, 0 for no limit
+double RATE_BURST = 0;                       // Default maximum tokens of a client, RATE_LIMIT if not given
+double RATE_IDLE = 60;                       // Seconds after which an idle client with a full bucket is forgotten
+struct rate_override *RATE_OVERRIDES = NULL; // Per-client overrides, sorted by client ID
+int rate_override_count = 0;
+struct rate_shard RATE_TABLE[RATE_SHARDS];
 
 void *handle_connection(void *);
+ssize_t add_trace_id(const char *, ssize_t, char *, uint64_t);
+int connect_to_proxy(int);
 char *forward_to_proxy(int, char *);
+void forward_bulk_to_proxy(int, SSL *, int, char *, ssize_t, ssize_t, int);
+ssize_t client_read(SSL *, int, void *, size_t);
+int client_write(SSL *, int, const void *, size_t);
+int route_udp(const char *, char *, size_t, struct sockaddr_in *);
+void setup_rate_limit(const char *);
+int compare_overrides(const void *, const void *);
+double rate_now();
+int rate_allow(int, double, int);
+void *sweep_rate_table(void *);
+void reject_bulk(SSL *, int);
+void setup_tls(const char *, const char *);
 void sigterm_handler(int);
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
     // Register SIGTERM signal handler
     signal(SIGTERM, sigterm_handler);
 
+    // Ignore SIGPIPE so that a client closing early does not kill the load balancer
+    signal(SIGPIPE, SIG_IGN);
+
+    // Extract TLS, UDP and rate limit settings from command line options
+    const char *cert_file = NULL;
+    const char *key_file = NULL;
+    const char *override_file = NULL;
+    int udp_workers = 0;
+    int option;
+    while ((option = getopt(argc, argv, "c:k:u:R:B:O:E:")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            cert_file = optarg;
+            break;
+        case 'k':
+            key_file = optarg;
+            break;
+        case 'u':
+            udp_workers = atoi(optarg);
+            break;
+        case 'R':
+            RATE_LIMIT = atof(optarg);
+            break;
+        case 'B':
+            RATE_BURST = atof(optarg);
+            break;
+        case 'O':
+            override_file = optarg;
+            break;
+        case 'E':
+            RATE_IDLE = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c cert -k key] [-u udp_workers] [-R rate] [-B burst] [-O overrides] [-E idle_seconds] <port> <rp_id1> <rp_id2> <rp_port1> <rp_port2>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Extract load balancer port from command line arguments
-    LB_PORT = atoi(argv[1]);
+    LB_PORT = atoi(argv[optind]);
 
     // Extract reverse proxy IDs and ports from command line arguments
     for (int i = 0; i < 2; i++)
     {
-        RP_IDS[i] = atoi(argv[2 + i]);
-        RP_PORTS[i] = atoi(argv[4 + i]);
+        RP_IDS[i] = atoi(argv[optind + 1 + i]);
+        RP_PORTS[i] = atoi(argv[optind + 3 + i]);
+    }
+
+    // Set up TLS termination if a certificate is given
+    if (cert_file != NULL)
+    {
+        setup_tls(cert_file, key_file != NULL ? key_file : cert_file);
+    }
+
+    // Set up request tracing before any thread is created
+    trace_init("LOAD BALANCER");
+
+    // Set up per-client rate limiting
+    setup_rate_limit(override_file);
+
+    // Serve the UDP fast path next to TCP if requested
+    if (udp_workers > 0)
+    {
+        udp_start(LB_PORT, udp_workers, route_udp, "lb.request_udp");
+        printf("[LOAD BALANCER]: Serving UDP on port %d with %d workers.\n", LB_PORT, udp_workers);
     }
 
     // Create a socket
@@ -73,7 +196,7 @@ int main(int argc, char const *argv[])
     }
 
     // Load balancer setup message
-    printf("[LOAD BALANCER]: Load balancer has started. Listening on port %d.\n", LB_PORT);
+    printf("[LOAD BALANCER]: Load balancer has started. Listening on port %d%s.\n", LB_PORT, TLS_CTX != NULL ? " with TLS" : "");
 
     // Accept and handle incoming connections
     int socket_id;
@@ -116,9 +239,52 @@ void *handle_connection(void *arg)
     int socket_id = *(int *)arg;
     free(arg);
     char buffer[MAX_BUFFER_SIZE]; // Buffer to store incoming data
+    ssize_t byte_length;
+    SSL *ssl = NULL;
+    uint64_t start = trace_now();
+
+    if (TLS_CTX != NULL)
+    {
+        // Disable Nagle's algorithm so that small handshake messages are not delayed
+        int opt = 1;
+        setsockopt(socket_id, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        // Do the TLS handshake in userspace; OpenSSL then hands the record layer to the kernel
+        ssl = SSL_new(TLS_CTX);
+        SSL_set_fd(ssl, socket_id);
+        if (SSL_accept(ssl) <= 0)
+        {
+            printf("[LOAD BALANCER]: TLS handshake failed.\n");
+            SSL_free(ssl);
+            close(socket_id);
+            pthread_exit(NULL);
+        }
+
+        // Report once whether the kernel took over record encryption
+        if (!ktls_reported)
+        {
+            ktls_reported = 1;
+            printf("[LOAD BALANCER]: Kernel TLS %s.\n", BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "is active" : "is unavailable. Encrypting in userspace");
+        }
+    }
 
     // Read data from the client
-    ssize_t byte_length = read(socket_id, buffer, MAX_BUFFER_SIZE);
+    byte_length = client_read(ssl, socket_id, buffer, MAX_BUFFER_SIZE - 1);
+
+    // Check for a bulk request header
+    int count = 0;
+    ssize_t header_length = byte_length > 0 ? bulk_parse_header(buffer, byte_length, &count, trace_process) : -1;
+
+    // Close the connection if the client sent nothing or an invalid bulk request
+    if (header_length < 0)
+    {
+        if (ssl != NULL)
+        {
+            SSL_free(ssl);
+        }
+        close(socket_id);
+        pthread_exit(NULL);
+    }
 
     // Null-terminate the buffer
     buffer[byte_length] = '\0';
@@ -130,6 +296,22 @@ void *handle_connection(void *arg)
     // Extract client_id from the buffer
     int client_id = atoi(strtok(buffer_copy, " "));
 
+    // Assign a trace ID if the client did not send one
+    uint64_t trace_id = trace_parse_id(buffer, byte_length);
+    char request[MAX_BUFFER_SIZE + TRACE_TOKEN_LENGTH];
+    char *forwarded = buffer;
+    if (trace_id == 0)
+    {
+        trace_id = trace_new_id();
+        ssize_t request_length = add_trace_id(buffer, byte_length, request, trace_id);
+        if (request_length > 0)
+        {
+            header_length += header_length > 0 ? TRACE_TOKEN_LENGTH : 0;
+            byte_length = request_length;
+            forwarded = request;
+        }
+    }
+
     // Determine which proxy to forward the request to
     int proxy_index = 0;
     if (client_id % 2 == 0)
@@ -137,22 +319,74 @@ void *handle_connection(void *arg)
         proxy_index = 1;
     }
 
-    // Log the request forwarding
-    printf("[LOAD BALANCER]: Request from Client #%d. Forwarding to Proxy #%d.\n", client_id, RP_IDS[proxy_index]);
+    // Reject clients over their rate limit before any upstream work
+    if (!rate_allow(client_id, header_length > 0 ? 1 + count / RATE_BULK_VALUES : 1, header_length > 0))
+    {
+        printf("[LOAD BALANCER]: Client #%d is over its rate limit. Returning %s.\n", client_id, RATE_LIMITED);
+        if (header_length > 0)
+        {
+            reject_bulk(ssl, socket_id);
+        }
+        else
+        {
+            client_write(ssl, socket_id, RATE_LIMITED, strlen(RATE_LIMITED));
+        }
+    }
+    else if (header_length > 0)
+    {
+        // Log the bulk request forwarding
+        printf("[LOAD BALANCER]: Bulk request of %d values from Client #%d. Forwarding to Proxy #%d.\n", count, client_id, RP_IDS[proxy_index]);
+
+        // Relay the values to the selected proxy and the results back to the client
+        uint64_t forward_start = trace_now();
+        forward_bulk_to_proxy(proxy_index, ssl, socket_id, forwarded, byte_length, header_length, count);
+        trace_span(trace_id, "lb.forward_bulk", forward_start, client_id);
+    }
+    else
+    {
+        // Log the request forwarding
+        printf("[LOAD BALANCER]: Request from Client #%d. Forwarding to Proxy #%d.\n", client_id, RP_IDS[proxy_index]);
 
-    // Forward the request to the selected proxy
-    char *result = forward_to_proxy(proxy_index, buffer);
+        // Forward the request to the selected proxy
+        uint64_t forward_start = trace_now();
+        char *result = forward_to_proxy(proxy_index, forwarded);
+        trace_span(trace_id, "lb.forward", forward_start, client_id);
 
-    // Send the result back to the client
-    send(socket_id, result, strlen(result), 0);
-    free(result);
+        // Send the result back to the client
+        client_write(ssl, socket_id, result, strlen(result));
+        free(result);
+    }
 
-    // Close the client socket and exit the thread
+    // End the TLS session
+    if (ssl != NULL)
+    {
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+    }
+
+    // Close the client socket, record the request span and exit the thread
     close(socket_id);
+    trace_span(trace_id, "lb.request", start, client_id);
     pthread_exit(NULL);
 }
 
-char *forward_to_proxy(int proxy_index, char *buffer)
+ssize_t add_trace_id(const char *buffer, ssize_t byte_length, char *request, uint64_t trace_id)
+{
+    // Insert the trace token at the end of the first line, 0 if the proxy could not read it in one go
+    const char *end = memchr(buffer, '\n', byte_length);
+    ssize_t line_length = end != NULL ? end - buffer : byte_length;
+    if (line_length + TRACE_TOKEN_LENGTH >= MAX_BUFFER_SIZE - 1)
+    {
+        return 0;
+    }
+    memcpy(request, buffer, line_length);
+    snprintf(request + line_length, TRACE_TOKEN_LENGTH + 1, " T%016llx", (unsigned long long)trace_id);
+    memcpy(request + line_length + TRACE_TOKEN_LENGTH, buffer + line_length, byte_length - line_length);
+    request[byte_length + TRACE_TOKEN_LENGTH] = '\0';
+    return byte_length + TRACE_TOKEN_LENGTH;
+}
+
+int connect_to_proxy(int proxy_index)
 {
     int status, client_fd;
     struct sockaddr_in serv_addr;
@@ -181,6 +415,13 @@ char *forward_to_proxy(int proxy_index, char *buffer)
         perror("Connection failed\n");
         exit(EXIT_FAILURE);
     }
+    return client_fd;
+}
+
+char *forward_to_proxy(int proxy_index, char *buffer)
+{
+    // Connect to proxy
+    int client_fd = connect_to_proxy(proxy_index);
 
     // Send the request to the proxy
     send(client_fd, buffer, strlen(buffer), 0);
@@ -197,6 +438,336 @@ char *forward_to_proxy(int proxy_index, char *buffer)
     return buffer2;
 }
 
+void forward_bulk_to_proxy(int proxy_index, SSL *ssl, int socket_id, char *buffer, ssize_t byte_length, ssize_t header_length, int count)
+{
+    // Connect to proxy
+    int client_fd = connect_to_proxy(proxy_index);
+
+    // Send the header and the values read so far to the proxy
+    send_all(client_fd, buffer, byte_length);
+
+    // Relay the rest of the values from the client to the proxy in chunks
+    char chunk[BULK_CHUNK_SIZE];
+    ssize_t remaining = header_length + (ssize_t)count * sizeof(float) - byte_length;
+    while (remaining > 0)
+    {
+        ssize_t n = client_read(ssl, socket_id, chunk, remaining < BULK_CHUNK_SIZE ? remaining : BULK_CHUNK_SIZE);
+        if (n <= 0 || send_all(client_fd, chunk, n) < 0)
+        {
+            close(client_fd);
+            return;
+        }
+        remaining -= n;
+    }
+
+    // Relay the results from the proxy back to the client as they arrive
+    remaining = (ssize_t)count * sizeof(float);
+    while (remaining > 0)
+    {
+        ssize_t n = read(client_fd, chunk, remaining < BULK_CHUNK_SIZE ? remaining : BULK_CHUNK_SIZE);
+        if (n <= 0 || client_write(ssl, socket_id, chunk, n) < 0)
+        {
+            break;
+        }
+        remaining -= n;
+    }
+
+    // Close the proxy connection
+    close(client_fd);
+}
+
+ssize_t client_read(SSL *ssl, int socket_id, void *buffer, size_t length)
+{
+    // Read from the client, through TLS if enabled
+    if (ssl != NULL)
+    {
+        return SSL_read(ssl, buffer, length);
+    }
+    return read(socket_id, buffer, length);
+}
+
+int client_write(SSL *ssl, int socket_id, const void *buffer, size_t length)
+{
+    // Write the whole buffer to the client, through TLS if enabled
+    if (ssl != NULL)
+    {
+        return SSL_write(ssl, buffer, length) > 0 ? 0 : -1;
+    }
+    return send_all(socket_id, buffer, length);
+}
+
+int route_udp(const char *request, char *reply, size_t reply_size, struct sockaddr_in *upstream)
+{
+    // Reject clients over their rate limit
+    int client_id = atoi(request);
+    if (!rate_allow(client_id, 1, 0))
+    {
+        snprintf(reply, reply_size, "%s", RATE_LIMITED);
+        return UDP_REPLY;
+    }
+
+    // Forward the datagram to the proxy chosen by the parity of the client ID
+    udp_address(upstream, RP_PORTS[client_id % 2 == 0 ? 1 : 0]);
+    return UDP_FORWARD;
+}
+
+void setup_rate_limit(const char *override_file)
+{
+    // Read the overrides, one "<client_id> <rate> <burst>" per line
+    if (override_file != NULL)
+    {
+        FILE *file = fopen(override_file, "r");
+        if (file == NULL)
+        {
+            perror("\nRate limit overrides cannot be read\n");
+            exit(EXIT_FAILURE);
+        }
+        char line[128];
+        int capacity = 0;
+        while (fgets(line, sizeof(line), file) != NULL)
+        {
+            struct rate_override entry;
+            if (line[0] == '#' || sscanf(line, "%d %lf %lf", &entry.client_id, &entry.rate, &entry.burst) != 3)
+            {
+                continue;
+            }
+
+            // A missing burst falls back like -B does, so that a limited client is never blocked for good
+            if (entry.burst <= 0)
+            {
+                entry.burst = entry.rate > 1 ? entry.rate : 1;
+            }
+            if (rate_override_count == capacity)
+            {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                RATE_OVERRIDES = (struct rate_override *)realloc(RATE_OVERRIDES, capacity * sizeof(struct rate_override));
+            }
+            RATE_OVERRIDES[rate_override_count++] = entry;
+        }
+        fclose(file);
+        qsort(RATE_OVERRIDES, rate_override_count, sizeof(struct rate_override), compare_overrides);
+    }
+
+    // Nothing to set up if no client is limited
+    if (RATE_LIMIT <= 0 && rate_override_count == 0)
+    {
+        return;
+    }
+    if (RATE_BURST <= 0)
+    {
+        RATE_BURST = RATE_LIMIT > 1 ? RATE_LIMIT : 1;
+    }
+
+    // Create the shards of the client table
+    for (int i = 0; i < RATE_SHARDS; i++)
+    {
+        pthread_mutex_init(&RATE_TABLE[i].lock, NULL);
+        RATE_TABLE[i].bucket_count = RATE_INITIAL_BUCKETS;
+        RATE_TABLE[i].buckets = (struct rate_entry **)calloc(RATE_INITIAL_BUCKETS, sizeof(struct rate_entry *));
+        RATE_TABLE[i].entry_count = 0;
+    }
+
+    // Forget idle clients in the background
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, sweep_rate_table, NULL);
+    pthread_detach(thread_id);
+    printf("[LOAD BALANCER]: Rate limiting clients to %.1f requests/s with bursts of %.0f, %d overrides.\n", RATE_LIMIT, RATE_BURST, rate_override_count);
+}
+
+int compare_overrides(const void *a, const void *b)
+{
+    // Order overrides by client ID
+    int x = ((const struct rate_override *)a)->client_id;
+    int y = ((const struct rate_override *)b)->client_id;
+    return (x > y) - (x < y);
+}
+
+double rate_now()
+{
+    // Monotonic time in seconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int rate_allow(int client_id, double cost, int debt)
+{
+    // Admit everything if no client is limited
+    if (RATE_LIMIT <= 0 && rate_override_count == 0)
+    {
+        return 1;
+    }
+
+    // Find the shard and bucket of the client
+    uint64_t hash = (uint64_t)(uint32_t)client_id * 0x9e3779b97f4a7c15ULL;
+    struct rate_shard *shard = &RATE_TABLE[hash >> 56];
+    double now = rate_now();
+    pthread_mutex_lock(&shard->lock);
+    struct rate_entry **bucket = &shard->buckets[(hash >> 16) & (shard->bucket_count - 1)];
+    struct rate_entry *entry = *bucket;
+    while (entry != NULL && entry->client_id != client_id)
+    {
+        entry = entry->next;
+    }
+
+    if (entry == NULL)
+    {
+        // Use the override of the client if there is one
+        double rate = RATE_LIMIT;
+        double burst = RATE_BURST;
+        struct rate_override key = {client_id, 0, 0};
+        struct rate_override *override = (struct rate_override *)bsearch(&key, RATE_OVERRIDES, rate_override_count, sizeof(struct rate_override), compare_overrides);
+        if (override != NULL)
+        {
+            rate = override->rate;
+            burst = override->burst;
+        }
+
+        // Clients without a limit are not tracked
+        if (rate <= 0)
+        {
+            pthread_mutex_unlock(&shard->lock);
+            return 1;
+        }
+
+        // Start the client with a full bucket
+        entry = (struct rate_entry *)malloc(sizeof(struct rate_entry));
+        entry->client_id = client_id;
+        entry->tokens = burst;
+        entry->last = now;
+        entry->rate = rate;
+        entry->burst = burst;
+        entry->next = *bucket;
+        *bucket = entry;
+        shard->entry_count++;
+
+        // Double the buckets of the shard when chains get long
+        if (shard->entry_count > 2 * shard->bucket_count)
+        {
+            size_t bucket_count = shard->bucket_count * 2;
+            struct rate_entry **buckets = (struct rate_entry **)calloc(bucket_count, sizeof(struct rate_entry *));
+            for (size_t i = 0; i < shard->bucket_count; i++)
+            {
+                while (shard->buckets[i] != NULL)
+                {
+                    struct rate_entry *moved = shard->buckets[i];
+                    shard->buckets[i] = moved->next;
+                    uint64_t moved_hash = (uint64_t)(uint32_t)moved->client_id * 0x9e3779b97f4a7c15ULL;
+                    struct rate_entry **target = &buckets[(moved_hash >> 16) & (bucket_count - 1)];
+                    moved->next = *target;
+                    *target = moved;
+                }
+            }
+            free(shard->buckets);
+            shard->buckets = buckets;
+            shard->bucket_count = bucket_count;
+        }
+    }
+
+    // Refill the bucket and admit the request if it can pay its cost
+    entry->tokens += (now - entry->last) * entry->rate;
+    if (entry->tokens > entry->burst)
+    {
+        entry->tokens = entry->burst;
+    }
+    entry->last = now;
+    int allowed = entry->tokens >= cost;
+
+    // A bulk request may cost more than the burst, so it only needs one token and leaves a debt
+    if (debt && entry->tokens >= 1)
+    {
+        allowed = 1;
+    }
+    if (allowed)
+    {
+        entry->tokens -= cost;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return allowed;
+}
+
+void *sweep_rate_table(void *arg)
+{
+    while (1)
+    {
+        sleep(RATE_SWEEP_INTERVAL);
+
+        // Forget clients idle long enough for their bucket to be full again; they come back unchanged
+        for (int i = 0; i < RATE_SHARDS; i++)
+        {
+            struct rate_shard *shard = &RATE_TABLE[i];
+            double now = rate_now();
+            pthread_mutex_lock(&shard->lock);
+            for (size_t j = 0; j < shard->bucket_count; j++)
+            {
+                struct rate_entry **link = &shard->buckets[j];
+                while (*link != NULL)
+                {
+                    struct rate_entry *entry = *link;
+                    double idle = now - entry->last;
+                    if (idle >= RATE_IDLE && entry->tokens + idle * entry->rate >= entry->burst)
+                    {
+                        *link = entry->next;
+                        free(entry);
+                        shard->entry_count--;
+                    }
+                    else
+                    {
+                        link = &entry->next;
+                    }
+                }
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+    return NULL;
+}
+
+void reject_bulk(SSL *ssl, int socket_id)
+{
+    // Answer with a single status value in place of the results; the caller closes without reading the values
+    float rejected = atof(RATE_LIMITED);
+    uint32_t bits;
+    memcpy(&bits, &rejected, sizeof(bits));
+    bits = htonl(bits);
+    client_write(ssl, socket_id, &bits, sizeof(bits));
+}
+
+void setup_tls(const char *cert_file, const char *key_file)
+{
+    // Create the server-side TLS context
+    TLS_CTX = SSL_CTX_new(TLS_server_method());
+    if (TLS_CTX == NULL)
+    {
+        ERR_print_errors_fp(stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    // Let OpenSSL move record encryption into the kernel (TCP_ULP "tls") after the handshake
+    SSL_CTX_set_min_proto_version(TLS_CTX, TLS1_2_VERSION);
+    SSL_CTX_set_options(TLS_CTX, SSL_OP_ENABLE_KTLS);
+
+    // Restrict ciphers to the AEADs kernel TLS can offload
+    SSL_CTX_set_cipher_list(TLS_CTX, "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+                                     "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384");
+    SSL_CTX_set_ciphersuites(TLS_CTX, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+
+    // Enable session resumption through the session cache and session tickets
+    SSL_CTX_set_session_id_context(TLS_CTX, (const unsigned char *)"load_balancer", strlen("load_balancer"));
+    SSL_CTX_set_session_cache_mode(TLS_CTX, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(TLS_CTX, TLS_SESSION_CACHE_SIZE);
+
+    // Load the certificate and the private key
+    if (SSL_CTX_use_certificate_chain_file(TLS_CTX, cert_file) <= 0 ||
+        SSL_CTX_use_PrivateKey_file(TLS_CTX, key_file, SSL_FILETYPE_PEM) <= 0 ||
+        !SSL_CTX_check_private_key(TLS_CTX))
+    {
+        fprintf(stderr, "[LOAD BALANCER]: Cannot load TLS certificate %s and key %s.\n", cert_file, key_file);
+        ERR_print_errors_fp(stderr);
+        exit(EXIT_FAILURE);
+    }
+}
+
 void sigterm_handler(int signo)
 {
     // Handle SIGTERM signal
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,32 +8,83 @@
 #include <time.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include "trace.h"
+#include "bulk.h"
+#include "udp.h"
 
-#define MAX_BUFFER_SIZE 80 // Maximum buffer size for reading from the socket
+#define MAX_BUFFER_SIZE 80        // Maximum buffer size for reading from the socket
+#define BULK_SPLIT_MIN 1024       // Minimum number of values to split a bulk request across the servers
 
 int RP_ID;
 int RP_PORT;
 int SERVER_IDS[3];
 int SERVER_PORTS[3];
 
+// Part of a bulk request forwarded to one server
+struct bulk_part
+{
+    int server_index;  // Index of the server computing the part
+    int client_id;     // Client ID of the request
+    uint64_t trace_id; // Trace ID of the request
+    int count;         // Number of values in the part
+    uint32_t *values;  // Values of the part in network byte order
+    uint32_t *results; // Results of the part in network byte order
+    int failed;        // Flag to indicate that the server did not return the results
+};
+
 void *handle_connection(void *);
+void handle_bulk(int, char *, ssize_t, ssize_t, int, int, uint64_t);
+int connect_to_server(int);
 char *forward_to_server(int, char *);
+void *forward_bulk_to_server(void *);
+int route_udp(const char *, char *, size_t, struct sockaddr_in *);
 void sigterm_handler(int);
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
     // Register SIGTERM signal handler
     signal(SIGTERM, sigterm_handler);
 
+    // Extract the number of UDP workers from command line options
+    int udp_workers = 0;
+    int option;
+    while ((option = getopt(argc, argv, "u:")) != -1)
+    {
+        if (option == 'u')
+        {
+            udp_workers = atoi(optarg);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-u udp_workers] <id> <port> <server_id1..3> <server_port1..3>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Extract reverse proxy ID and port from command line arguments
-    RP_ID = atoi(argv[1]);
-    RP_PORT = atoi(argv[2]);
+    RP_ID = atoi(argv[optind]);
+    RP_PORT = atoi(argv[optind + 1]);
 
     // Extract server IDs and ports from command line arguments
     for (int i = 0; i < 3; i++)
     {
-        SERVER_IDS[i] = atoi(argv[3 + i]);
-        SERVER_PORTS[i] = atoi(argv[6 + i]);
+        SERVER_IDS[i] = atoi(argv[optind + 2 + i]);
+        SERVER_PORTS[i] = atoi(argv[optind + 5 + i]);
+    }
+
+    // Set up request tracing before any thread is created
+    char trace_name[32];
+    snprintf(trace_name, sizeof(trace_name), "REVERSE PROXY #%d", RP_ID);
+    trace_init(trace_name);
+
+    // Serve the UDP fast path next to TCP if requested
+    if (udp_workers > 0)
+    {
+        udp_start(RP_PORT, udp_workers, route_udp, "proxy.request_udp");
+        printf("[REVERSE PROXY #%d]: Serving UDP on port %d with %d workers.\n", RP_ID, RP_PORT, udp_workers);
     }
 
     // Create a socket
@@ -119,9 +171,33 @@ void *handle_connection(void *arg)
     int socket_id = *(int *)arg;
     free(arg);
     char buffer[MAX_BUFFER_SIZE]; // Buffer to store incoming data
+    uint64_t start = trace_now();
 
     // Read data from the load balancer
-    ssize_t byte_length = read(socket_id, buffer, MAX_BUFFER_SIZE);
+    ssize_t byte_length = read(socket_id, buffer, MAX_BUFFER_SIZE - 1);
+
+    // Check for a bulk request header
+    int count = 0;
+    ssize_t header_length = byte_length > 0 ? bulk_parse_header(buffer, byte_length, &count, trace_process) : -1;
+
+    // Close the connection if nothing or an invalid bulk request was sent
+    if (header_length < 0)
+    {
+        close(socket_id);
+        pthread_exit(NULL);
+    }
+
+    // Extract the trace ID assigned by the client or the load balancer
+    uint64_t trace_id = trace_parse_id(buffer, byte_length);
+
+    // Handle bulk requests separately
+    if (header_length > 0)
+    {
+        handle_bulk(socket_id, buffer, byte_length, header_length, atoi(buffer), count, trace_id);
+        close(socket_id);
+        trace_span(trace_id, "proxy.request_bulk", start, atoi(buffer));
+        pthread_exit(NULL);
+    }
 
     // Null-terminate the buffer
     buffer[byte_length] = '\0';
@@ -148,19 +224,105 @@ void *handle_connection(void *arg)
         printf("[REVERSE PROXY #%d]: Request from Client #%d. Forwarding to Server #%d.\n", RP_ID, client_id, SERVER_IDS[server_index]);
 
         // Forward the request to the selected server
+        uint64_t forward_start = trace_now();
         char *result = forward_to_server(server_index, buffer);
+        trace_span(trace_id, "proxy.forward", forward_start, client_id);
 
         // Send the result back to the client
         send(socket_id, result, strlen(result), 0);
         free(result);
     }
 
-    // Close the socket and exit the threat
+    // Close the socket, record the request span and exit the threat
     close(socket_id);
+    trace_span(trace_id, "proxy.request", start, client_id);
     pthread_exit(NULL);
 }
 
-char *forward_to_server(int server_index, char *buffer)
+void handle_bulk(int socket_id, char *buffer, ssize_t byte_length, ssize_t header_length, int client_id, int count, uint64_t trace_id)
+{
+    // Read all values of the request; part of them may already be in the buffer
+    size_t size = (size_t)count * sizeof(uint32_t);
+    uint32_t *values = (uint32_t *)malloc(size);
+    uint32_t *results = (uint32_t *)malloc(size);
+    size_t received = byte_length - header_length < (ssize_t)size ? byte_length - header_length : size;
+    memcpy(values, buffer + header_length, received);
+    if (recv_all(socket_id, (char *)values + received, size - received) < 0)
+    {
+        free(values);
+        free(results);
+        return;
+    }
+
+    // Split large requests evenly across the three servers, send small ones to a random server
+    struct bulk_part parts[3];
+    pthread_t thread_ids[3];
+    int part_count = count >= BULK_SPLIT_MIN ? 3 : 1;
+    srand(time(0));
+    for (int i = 0; i < part_count; i++)
+    {
+        int first = (int)((long)count * i / part_count);
+        int last = (int)((long)count * (i + 1) / part_count);
+        parts[i].server_index = part_count == 3 ? i : rand() % 3;
+        parts[i].client_id = client_id;
+        parts[i].trace_id = trace_id;
+        parts[i].count = last - first;
+        parts[i].values = values + first;
+        parts[i].results = results + first;
+        parts[i].failed = 0;
+    }
+    printf("[REVERSE PROXY #%d]: Bulk request of %d values from Client #%d. Forwarding to %d server(s).\n", RP_ID, count, client_id, part_count);
+
+    // Compute the parts on the servers in parallel
+    for (int i = 0; i < part_count; i++)
+    {
+        pthread_create(&thread_ids[i], NULL, forward_bulk_to_server, &parts[i]);
+    }
+
+    // Reassemble the results in order and stream each part back as soon as it is ready
+    for (int i = 0; i < part_count; i++)
+    {
+        pthread_join(thread_ids[i], NULL);
+
+        // Close the connection without the rest of the results if a part failed, so that the client sees the request fail
+        if (parts[i].failed)
+        {
+            for (i++; i < part_count; i++)
+            {
+                pthread_join(thread_ids[i], NULL);
+            }
+            break;
+        }
+
+        // Apply the illegal request rule to each value
+        for (int j = 0; j < parts[i].count; j++)
+        {
+            uint32_t bits = ntohl(parts[i].values[j]);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            if (value < 0)
+            {
+                float illegal = -1;
+                memcpy(&bits, &illegal, sizeof(bits));
+                parts[i].results[j] = htonl(bits);
+            }
+        }
+        if (send_all(socket_id, parts[i].results, (size_t)parts[i].count * sizeof(uint32_t)) < 0)
+        {
+            // Wait for the other parts before releasing their buffers
+            for (i++; i < part_count; i++)
+            {
+                pthread_join(thread_ids[i], NULL);
+            }
+            break;
+        }
+    }
+
+    free(values);
+    free(results);
+}
+
+int connect_to_server(int server_index)
 {
     int status, client_fd;
     struct sockaddr_in serv_addr;
@@ -189,6 +351,13 @@ char *forward_to_server(int server_index, char *buffer)
         perror("Connection failed\n");
         exit(EXIT_FAILURE);
     }
+    return client_fd;
+}
+
+char *forward_to_server(int server_index, char *buffer)
+{
+    // Connect to server
+    int client_fd = connect_to_server(server_index);
 
     // Send the request to the server
     send(client_fd, buffer, strlen(buffer), 0);
@@ -205,6 +374,64 @@ char *forward_to_server(int server_index, char *buffer)
     return buffer2;
 }
 
+void *forward_bulk_to_server(void *arg)
+{
+    struct bulk_part *part = (struct bulk_part *)arg;
+    size_t size = (size_t)part->count * sizeof(uint32_t);
+    uint64_t start = trace_now();
+
+    // Connect to server
+    int client_fd = connect_to_server(part->server_index);
+
+    // Send the header of the part, passing the trace ID on
+    char header[MAX_BUFFER_SIZE];
+    int header_length = part->trace_id != 0
+                            ? snprintf(header, sizeof(header), "%d B %d T%016llx\n", part->client_id, part->count, (unsigned long long)part->trace_id)
+                            : snprintf(header, sizeof(header), "%d B %d\n", part->client_id, part->count);
+
+    // Send the values while reading the results the server streams back
+    if (send_all(client_fd, header, header_length) < 0 ||
+        exchange_all(client_fd, part->values, size, part->results, size) < 0)
+    {
+        // Mark the part as failed; its results are never sent
+        printf("[REVERSE PROXY #%d]: Bulk request to Server #%d failed.\n", RP_ID, SERVER_IDS[part->server_index]);
+        part->failed = 1;
+    }
+
+    // Close the server connection
+    close(client_fd);
+    trace_span(part->trace_id, "proxy.forward_bulk", start, part->client_id);
+    return NULL;
+}
+
+int route_udp(const char *request, char *reply, size_t reply_size, struct sockaddr_in *upstream)
+{
+    // Per-thread seed, as rand is neither thread-safe nor cheap to reseed per request
+    static __thread unsigned int seed = 0;
+    if (seed == 0)
+    {
+        seed = (unsigned int)trace_new_id();
+    }
+
+    int client_id;
+    float req_num;
+    if (sscanf(request, "%d %f", &client_id, &req_num) != 2)
+    {
+        return UDP_DROP;
+    }
+
+    // Answer illegal requests directly
+    if (req_num < 0)
+    {
+        snprintf(reply, reply_size, "-1");
+        return UDP_REPLY;
+    }
+
+    // Forward the datagram to a random server
+    udp_address(upstream, SERVER_PORTS[rand_r(&seed) % 3]);
+    return UDP_FORWARD;
+}
+
 void sigterm_handler(int signo)
 {
     // Handle SIGTERM signal
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,22 +7,58 @@
 #include <pthread.h>
 #include <math.h>
 #include <signal.h>
+#include <stdint.h>
+#include "trace.h"
+#include "bulk.h"
+#include "udp.h"
 
-#define MAX_BUFFER_SIZE 80 // Maximum buffer size for reading from the socket
+#define MAX_BUFFER_SIZE 80        // Maximum buffer size for reading from the socket
+#define BULK_CHUNK_VALUES 4096    // Number of values computed and sent back at a time in a bulk request
 
 int SERVER_ID;
 int SERVER_PORT;
 void *handle_connection(void *);
+void handle_bulk(int, char *, ssize_t, ssize_t, int, int);
+void sqrt_batch(float *, int);
+int answer_udp(const char *, char *, size_t, struct sockaddr_in *);
 void sigterm_handler(int);
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
     // Register SIGTERM signal handler
     signal(SIGTERM, sigterm_handler);
 
+    // Extract the number of UDP workers from command line options
+    int udp_workers = 0;
+    int option;
+    while ((option = getopt(argc, argv, "u:")) != -1)
+    {
+        if (option == 'u')
+        {
+            udp_workers = atoi(optarg);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [-u udp_workers] <id> <port>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Extract server ID and port from command line arguments
-    SERVER_ID = atoi(argv[1]);
-    SERVER_PORT = atoi(argv[2]);
+    SERVER_ID = atoi(argv[optind]);
+    SERVER_PORT = atoi(argv[optind + 1]);
+
+    // Set up request tracing before any thread is created
+    char trace_name[32];
+    snprintf(trace_name, sizeof(trace_name), "SERVER #%d", SERVER_ID);
+    trace_init(trace_name);
+
+    // Serve the UDP fast path next to TCP if requested
+    if (udp_workers > 0)
+    {
+        udp_start(SERVER_PORT, udp_workers, answer_udp, "server.request_udp");
+        printf("[SERVER #%d]: Serving UDP on port %d with %d workers.\n", SERVER_ID, SERVER_PORT, udp_workers);
+    }
     int server_fd;
 
     // Create a socket
@@ -107,9 +144,30 @@ void *handle_connection(void *arg)
     int socket_id = *(int *)arg;
     free(arg);
     char buffer[MAX_BUFFER_SIZE]; // Buffer to store incoming data
+    uint64_t start = trace_now();
 
     // Read data from the reverse proxy
-    ssize_t byte_length = read(socket_id, buffer, MAX_BUFFER_SIZE);
+    ssize_t byte_length = read(socket_id, buffer, MAX_BUFFER_SIZE - 1);
+
+    // Check for a bulk request header
+    int count = 0;
+    ssize_t header_length = byte_length > 0 ? bulk_parse_header(buffer, byte_length, &count, trace_process) : -1;
+
+    // Close the connection if nothing or an invalid bulk request was sent
+    if (header_length < 0)
+    {
+        close(socket_id);
+        pthread_exit(NULL);
+    }
+
+    // Handle bulk requests separately
+    if (header_length > 0)
+    {
+        handle_bulk(socket_id, buffer, byte_length, header_length, atoi(buffer), count);
+        close(socket_id);
+        trace_span(trace_parse_id(buffer, byte_length), "server.request_bulk", start, atoi(buffer));
+        pthread_exit(NULL);
+    }
 
     // Null-terminate the buffer
     buffer[byte_length] = '\0';
@@ -132,11 +190,86 @@ void *handle_connection(void *arg)
     // Send response back to the client
     send(socket_id, response, strlen(response), 0);
 
-    // Close the client socket and exit the thread
+    // Close the client socket, record the request span and exit the thread
     close(socket_id);
+    trace_span(trace_parse_id(buffer, byte_length), "server.request", start, client_id);
     pthread_exit(NULL);
 }
 
+void handle_bulk(int socket_id, char *buffer, ssize_t byte_length, ssize_t header_length, int client_id, int count)
+{
+    printf("[SERVER #%d]: Received %d values from Client #%d. Returning their square roots.\n", SERVER_ID, count, client_id);
+
+    // Values already read together with the header
+    char *pending = buffer + header_length;
+    size_t pending_length = byte_length - header_length;
+
+    // Chunk of values, read as network byte order words and computed as floats
+    union
+    {
+        uint32_t bits[BULK_CHUNK_VALUES];
+        float values[BULK_CHUNK_VALUES];
+    } data;
+
+    // Compute the values chunk by chunk and stream the results back
+    for (int done = 0; done < count;)
+    {
+        int chunk = count - done < BULK_CHUNK_VALUES ? count - done : BULK_CHUNK_VALUES;
+        size_t size = (size_t)chunk * sizeof(uint32_t);
+
+        // Fill the chunk from the pending bytes first, then from the socket
+        size_t copied = pending_length < size ? pending_length : size;
+        memcpy(data.bits, pending, copied);
+        pending += copied;
+        pending_length -= copied;
+        if (recv_all(socket_id, (char *)data.bits + copied, size - copied) < 0)
+        {
+            return;
+        }
+
+        // Convert to host byte order, compute the square roots, and convert back
+        for (int i = 0; i < chunk; i++)
+        {
+            data.bits[i] = ntohl(data.bits[i]);
+        }
+        sqrt_batch(data.values, chunk);
+        for (int i = 0; i < chunk; i++)
+        {
+            data.bits[i] = htonl(data.bits[i]);
+        }
+
+        // Send the results of the chunk back
+        if (send_all(socket_id, data.bits, size) < 0)
+        {
+            return;
+        }
+        done += chunk;
+    }
+}
+
+void sqrt_batch(float *values, int count)
+{
+    // Branch-free loop that the compiler vectorizes (needs -fno-math-errno)
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = sqrtf(values[i]);
+    }
+}
+
+int answer_udp(const char *request, char *reply, size_t reply_size, struct sockaddr_in *upstream)
+{
+    int client_id;
+    float req_num;
+    if (sscanf(request, "%d %f", &client_id, &req_num) != 2)
+    {
+        return UDP_DROP;
+    }
+
+    // Answer with the square root
+    snprintf(reply, reply_size, "%.2f", sqrt(req_num));
+    return UDP_REPLY;
+}
+
 void sigterm_handler(int signo)
 {
     // Handle SIGTERM signal
@@ -0,0 +1,293 @@
+// Request tracing shared by the client, load balancer, reverse proxies and servers.
+//
+// A trace ID travels with each request as a " T<16 hex digits>" token after the
+// request text (or after the count of a bulk header). Each tier records spans
+// into a ring buffer owned by the recording thread and writes them as Chrome
+// trace JSON to $TRACE_DIR/trace-<pid>.json (default /tmp) on SIGUSR1.
+//
+// Sampling:
+//   TRACE_SAMPLE  percent of trace IDs kept on every tier (head-based, default 1)
+//   TRACE_TAIL    keep spans slower than the running p99 of their span name on the tier
+//                 (tail-based, default 1). Each tier decides alone, so tail sampling keeps
+//                 single slow spans; only head-based sampling keeps whole requests.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#define TRACE_TOKEN_LENGTH 18   // Length of the " T<16 hex digits>" trace token
+#define TRACE_RING_SIZE 1024    // Number of spans kept per ring buffer
+#define TRACE_BUCKETS 64        // Number of log2 latency buckets used to estimate p99
+#define TRACE_NAMES 16          // Number of span names with their own latency histogram
+#define TRACE_P99_INTERVAL 256  // Number of spans between p99 estimates
+#define TRACE_P99_MIN_SPANS 100 // Number of spans needed before tail sampling starts
+
+// A finished span
+struct trace_span
+{
+    uint64_t trace_id;
+    const char *name;  // Static string naming the span
+    uint64_t start;    // Start time in microseconds since the epoch
+    uint64_t duration; // Duration in microseconds
+    int client_id;
+    int tid; // Thread ID of the recording thread
+};
+
+// Latency distribution of one span name
+struct trace_latency
+{
+    _Atomic(const char *) name;            // Span name, NULL if the slot is free
+    atomic_ulong histogram[TRACE_BUCKETS]; // Span count per log2 duration bucket
+    atomic_ulong count;                    // Number of spans seen
+    atomic_ulong p99;                      // Current p99 duration estimate in microseconds, 0 until known
+};
+
+// Ring buffer of the spans recorded by one thread
+struct trace_ring
+{
+    struct trace_span spans[TRACE_RING_SIZE];
+    atomic_ulong head;            // Number of spans written so far
+    int tid;                      // Thread ID of the current owner
+    struct trace_ring *next;      // Next ring in the list of all rings
+    struct trace_ring *next_free; // Next ring in the list of unused rings
+};
+
+static char trace_process[64];                     // Name of the tier in the trace viewer
+static int trace_sample = 100;                     // Head-based sample rate in hundredths of a percent
+static int trace_tail = 1;                         // Flag to keep spans slower than p99
+static struct trace_ring *trace_rings = NULL;      // All rings, including those of exited threads
+static struct trace_ring *trace_free_rings = NULL; // Rings of exited threads, reused by new threads
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t trace_key;
+static __thread struct trace_ring *trace_local = NULL;
+static struct trace_latency trace_latencies[TRACE_NAMES]; // Latency distribution per span name
+
+static inline uint64_t trace_now()
+{
+    // Wall-clock time so that spans of different processes line up
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint64_t trace_new_id()
+{
+    // Mix the time, process and a per-thread counter (splitmix64)
+    static __thread uint64_t counter = 0;
+    uint64_t x = trace_now() ^ ((uint64_t)getpid() << 40) ^ (++counter << 20) ^ (uint64_t)syscall(SYS_gettid);
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x != 0 ? x : 1;
+}
+
+static inline uint64_t trace_kept_id()
+{
+    // A multiple of 10000 passes head-based sampling on every tier that samples at all
+    uint64_t x = trace_new_id() / 10000 * 10000;
+    return x != 0 ? x : 10000;
+}
+
+static inline uint64_t trace_parse_id(const char *buffer, size_t length)
+{
+    // Find the " T<hex>" token on the first line of a request, 0 if there is none
+    for (size_t i = 0; i + 1 < length && buffer[i] != '\n'; i++)
+    {
+        if (buffer[i] == ' ' && buffer[i + 1] == 'T')
+        {
+            return strtoull(buffer + i + 2, NULL, 16);
+        }
+    }
+    return 0;
+}
+
+static inline void trace_release_ring(void *ring)
+{
+    // Hand the ring of an exiting thread to the next new thread; its spans stay until overwritten
+    pthread_mutex_lock(&trace_lock);
+    ((struct trace_ring *)ring)->next_free = trace_free_rings;
+    trace_free_rings = (struct trace_ring *)ring;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static inline struct trace_ring *trace_get_ring()
+{
+    // Take a ring for this thread, reusing one of an exited thread if possible
+    if (trace_local == NULL)
+    {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_free_rings != NULL)
+        {
+            trace_local = trace_free_rings;
+            trace_free_rings = trace_local->next_free;
+        }
+        else
+        {
+            trace_local = (struct trace_ring *)calloc(1, sizeof(struct trace_ring));
+            trace_local->next = trace_rings;
+            trace_rings = trace_local;
+        }
+        pthread_mutex_unlock(&trace_lock);
+        trace_local->tid = (int)syscall(SYS_gettid);
+        pthread_setspecific(trace_key, trace_local);
+    }
+    return trace_local;
+}
+
+static inline struct trace_latency *trace_get_latency(const char *name)
+{
+    // Find the slot of the span name, claiming a free one for a new name; extra names share the last slot
+    for (int i = 0; i < TRACE_NAMES - 1; i++)
+    {
+        const char *current = atomic_load(&trace_latencies[i].name);
+        if (current == NULL && atomic_compare_exchange_strong(&trace_latencies[i].name, &current, name))
+        {
+            return &trace_latencies[i];
+        }
+        if (current == name || strcmp(current, name) == 0)
+        {
+            return &trace_latencies[i];
+        }
+    }
+    return &trace_latencies[TRACE_NAMES - 1];
+}
+
+static inline void trace_update_p99(struct trace_latency *latency)
+{
+    // Estimate p99 as the upper bound of the bucket holding the 99th percentile
+    uint64_t counts[TRACE_BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < TRACE_BUCKETS; i++)
+    {
+        counts[i] = atomic_load(&latency->histogram[i]);
+        total += counts[i];
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < TRACE_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen * 100 >= total * 99)
+        {
+            atomic_store(&latency->p99, i == 0 ? 1 : 1ULL << i);
+            return;
+        }
+    }
+}
+
+static inline void trace_span(uint64_t trace_id, const char *name, uint64_t start, int client_id)
+{
+    uint64_t duration = trace_now() - start;
+
+    // Track the latency distribution of the span name
+    struct trace_latency *latency = trace_get_latency(name);
+    int bucket = duration == 0 ? 0 : 64 - __builtin_clzll(duration);
+    atomic_fetch_add(&latency->histogram[bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1], 1);
+    uint64_t count = atomic_fetch_add(&latency->count, 1) + 1;
+    if (count == TRACE_P99_MIN_SPANS || (count > TRACE_P99_MIN_SPANS && count % TRACE_P99_INTERVAL == 0))
+    {
+        trace_update_p99(latency);
+    }
+
+    // Keep sampled traces and, with tail sampling, all spans slower than the p99 of their name
+    uint64_t p99 = atomic_load(&latency->p99);
+    int head_sampled = trace_id % 10000 < (uint64_t)trace_sample;
+    int tail_sampled = trace_tail && p99 != 0 && duration >= p99;
+    if (!head_sampled && !tail_sampled)
+    {
+        return;
+    }
+
+    // Record the span in the ring of this thread
+    struct trace_ring *ring = trace_get_ring();
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_span *span = &ring->spans[head % TRACE_RING_SIZE];
+    span->trace_id = trace_id;
+    span->name = name;
+    span->start = start;
+    span->duration = duration;
+    span->client_id = client_id;
+    span->tid = ring->tid;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static inline void trace_dump()
+{
+    // Write the spans as Chrome trace JSON; spans written during the dump may be torn
+    const char *dir = getenv("TRACE_DIR") != NULL ? getenv("TRACE_DIR") : "/tmp";
+    char path[256];
+    snprintf(path, sizeof(path), "%s/trace-%d.json", dir, getpid());
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("Trace dump failed\n");
+        return;
+    }
+
+    int pid = getpid();
+    int spans = 0;
+    fprintf(file, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid, trace_process);
+    pthread_mutex_lock(&trace_lock);
+    for (struct trace_ring *ring = trace_rings; ring != NULL; ring = ring->next)
+    {
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (unsigned long i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0; i < head; i++)
+        {
+            struct trace_span *span = &ring->spans[i % TRACE_RING_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"trace_id\":\"%016llx\",\"client_id\":%d}}",
+                    span->name, (unsigned long long)span->start, (unsigned long long)span->duration, pid, span->tid, (unsigned long long)span->trace_id, span->client_id);
+            spans++;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("[%s]: Dumped %d spans to %s.\n", trace_process, spans, path);
+}
+
+static inline void *trace_dump_thread(void *arg)
+{
+    // Dump the spans each time SIGUSR1 arrives
+    sigset_t *signals = (sigset_t *)arg;
+    int signo;
+    while (sigwait(signals, &signo) == 0)
+    {
+        trace_dump();
+    }
+    return NULL;
+}
+
+static inline void trace_init(const char *process)
+{
+    // Read the sampling configuration
+    snprintf(trace_process, sizeof(trace_process), "%s", process);
+    if (getenv("TRACE_SAMPLE") != NULL)
+    {
+        trace_sample = (int)(atof(getenv("TRACE_SAMPLE")) * 100);
+    }
+    if (getenv("TRACE_TAIL") != NULL)
+    {
+        trace_tail = atoi(getenv("TRACE_TAIL"));
+    }
+    pthread_key_create(&trace_key, trace_release_ring);
+
+    // Block SIGUSR1 in all threads created from here on and handle it in a dedicated thread
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_t thread_id;
+    pthread_create(&thread_id, NULL, trace_dump_thread, &signals);
+    pthread_detach(thread_id);
+}
+
+#endif
@@ -0,0 +1,281 @@
+// UDP fast path shared by the load balancer, reverse proxies and servers.
+//
+// A request is one datagram "<request_id> <client_id> <value> T<trace_id>" and its
+// reply is "<request_id> <result>". The request ID changes at every hop, but the
+// trace token is forwarded unchanged (and added by the first tier if the sender left
+// it out), and each worker records a span from a request to its reply. Each worker thread owns a SO_REUSEPORT socket bound to
+// the component port, so the kernel spreads datagrams across workers, and an
+// ephemeral socket for forwarding upstream. Datagrams are received with
+// recvmmsg and sent with sendmmsg in batches of UDP_BATCH, which need _GNU_SOURCE
+// to be defined before the first include.
+#ifndef UDP_H
+#define UDP_H
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "trace.h"
+
+#define UDP_BATCH 32           // Number of datagrams received or sent per system call
+#define UDP_DATAGRAM_SIZE 128  // Maximum size of a datagram
+#define UDP_PENDING 4096       // Number of forwarded requests a worker waits for at a time
+
+// Decision of a UDP handler
+#define UDP_DROP 0    // Ignore the request
+#define UDP_REPLY 1   // Answer the request with the reply
+#define UDP_FORWARD 2 // Forward the request to the upstream address
+
+// Handles "<client_id> <value>", filling either the reply or the upstream address
+typedef int (*udp_handler)(const char *request, char *reply, size_t reply_size, struct sockaddr_in *upstream);
+
+// Batch of datagrams for recvmmsg and sendmmsg
+struct udp_batch
+{
+    struct mmsghdr messages[UDP_BATCH];
+    struct iovec iovecs[UDP_BATCH];
+    struct sockaddr_in addresses[UDP_BATCH];
+    char data[UDP_BATCH][UDP_DATAGRAM_SIZE];
+    int count;
+};
+
+// Request forwarded upstream and waiting for its reply
+struct udp_pending
+{
+    uint64_t id;                // Request ID used upstream, 0 if the slot is free
+    uint64_t origin_id;         // Request ID used by the sender
+    struct sockaddr_in address; // Address of the sender
+    uint64_t trace_id;          // Trace ID of the request
+    uint64_t start;             // Time the request arrived
+    int client_id;              // Client that sent the request
+};
+
+// Arguments of a UDP worker thread
+struct udp_worker_args
+{
+    int port;
+    udp_handler handler;
+    const char *span_name; // Name of the span recorded for each request
+};
+
+static inline int udp_open(int port)
+{
+    // Create a UDP socket, bound with SO_REUSEPORT if a port is given
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        perror("\nUDP socket creation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (port > 0)
+    {
+        int opt = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
+        {
+            perror("\nUDP setsockopt failed\n");
+            exit(EXIT_FAILURE);
+        }
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(port);
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        {
+            perror("\nUDP port binding failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return fd;
+}
+
+static inline void udp_address(struct sockaddr_in *address, int port)
+{
+    // Local address of another component
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address->sin_addr);
+}
+
+static inline int udp_receive(int fd, struct udp_batch *batch)
+{
+    // Receive up to UDP_BATCH datagrams without blocking and null-terminate them
+    for (int i = 0; i < UDP_BATCH; i++)
+    {
+        batch->iovecs[i].iov_base = batch->data[i];
+        batch->iovecs[i].iov_len = UDP_DATAGRAM_SIZE - 1;
+        memset(&batch->messages[i].msg_hdr, 0, sizeof(struct msghdr));
+        batch->messages[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+        batch->messages[i].msg_hdr.msg_name = &batch->addresses[i];
+        batch->messages[i].msg_hdr.msg_namelen = sizeof(batch->addresses[i]);
+    }
+    int count = recvmmsg(fd, batch->messages, UDP_BATCH, MSG_DONTWAIT, NULL);
+    batch->count = count > 0 ? count : 0;
+    for (int i = 0; i < batch->count; i++)
+    {
+        batch->data[i][batch->messages[i].msg_len] = '\0';
+    }
+    return batch->count;
+}
+
+static inline void udp_flush(int fd, struct udp_batch *batch)
+{
+    // Send all queued datagrams; datagrams the kernel refuses are dropped like lost ones
+    int sent = 0;
+    while (sent < batch->count)
+    {
+        int n = sendmmsg(fd, batch->messages + sent, batch->count - sent, 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    batch->count = 0;
+}
+
+static inline void udp_add(int fd, struct udp_batch *batch, const struct sockaddr_in *to, const char *format, ...)
+{
+    // Queue a datagram, sending the batch first if it is full
+    if (batch->count == UDP_BATCH)
+    {
+        udp_flush(fd, batch);
+    }
+    int i = batch->count++;
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(batch->data[i], UDP_DATAGRAM_SIZE, format, args);
+    va_end(args);
+    batch->addresses[i] = *to;
+    batch->iovecs[i].iov_base = batch->data[i];
+    batch->iovecs[i].iov_len = length < UDP_DATAGRAM_SIZE ? length : UDP_DATAGRAM_SIZE - 1;
+    memset(&batch->messages[i].msg_hdr, 0, sizeof(struct msghdr));
+    batch->messages[i].msg_hdr.msg_iov = &batch->iovecs[i];
+    batch->messages[i].msg_hdr.msg_iovlen = 1;
+    batch->messages[i].msg_hdr.msg_name = &batch->addresses[i];
+    batch->messages[i].msg_hdr.msg_namelen = sizeof(batch->addresses[i]);
+}
+
+static inline void *udp_worker(void *arg)
+{
+    struct udp_worker_args *args = (struct udp_worker_args *)arg;
+    int listen_fd = udp_open(args->port);
+    int upstream_fd = udp_open(0);
+    struct udp_pending *pending = (struct udp_pending *)calloc(UDP_PENDING, sizeof(struct udp_pending));
+    uint64_t next_id = 0;
+
+    // Batches of received datagrams, replies to senders and requests to upstream
+    struct udp_batch *received = (struct udp_batch *)malloc(sizeof(struct udp_batch));
+    struct udp_batch *replies = (struct udp_batch *)calloc(1, sizeof(struct udp_batch));
+    struct udp_batch *forwards = (struct udp_batch *)calloc(1, sizeof(struct udp_batch));
+
+    while (1)
+    {
+        struct pollfd fds[2] = {{listen_fd, POLLIN, 0}, {upstream_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0)
+        {
+            continue;
+        }
+
+        // Handle requests from senders
+        if ((fds[0].revents & POLLIN) && udp_receive(listen_fd, received) > 0)
+        {
+            for (int i = 0; i < received->count; i++)
+            {
+                uint64_t start = trace_now();
+                char *request;
+                uint64_t id = strtoull(received->data[i], &request, 10);
+                char reply[UDP_DATAGRAM_SIZE];
+                struct sockaddr_in upstream;
+                while (*request == ' ')
+                {
+                    request++;
+                }
+                int decision = args->handler(request, reply, sizeof(reply), &upstream);
+
+                // Assign a trace ID if the sender did not send one
+                uint64_t trace_id = trace_parse_id(request, strlen(request));
+                int has_trace_id = trace_id != 0;
+                if (!has_trace_id)
+                {
+                    trace_id = trace_new_id();
+                }
+                if (decision == UDP_REPLY)
+                {
+                    udp_add(listen_fd, replies, &received->addresses[i], "%llu %s", (unsigned long long)id, reply);
+                    trace_span(trace_id, args->span_name, start, atoi(request));
+                }
+                else if (decision == UDP_FORWARD)
+                {
+                    // Remember the sender under a new request ID; an older request in the slot is given up
+                    struct udp_pending *slot = &pending[++next_id % UDP_PENDING];
+                    slot->id = next_id;
+                    slot->origin_id = id;
+                    slot->address = received->addresses[i];
+                    slot->trace_id = trace_id;
+                    slot->start = start;
+                    slot->client_id = atoi(request);
+                    if (has_trace_id)
+                    {
+                        udp_add(upstream_fd, forwards, &upstream, "%llu %s", (unsigned long long)next_id, request);
+                    }
+                    else
+                    {
+                        udp_add(upstream_fd, forwards, &upstream, "%llu %s T%016llx", (unsigned long long)next_id, request, (unsigned long long)trace_id);
+                    }
+                }
+            }
+        }
+
+        // Relay replies from upstream back to their senders
+        if ((fds[1].revents & POLLIN) && udp_receive(upstream_fd, received) > 0)
+        {
+            for (int i = 0; i < received->count; i++)
+            {
+                char *reply;
+                uint64_t id = strtoull(received->data[i], &reply, 10);
+                struct udp_pending *slot = &pending[id % UDP_PENDING];
+                if (id != 0 && slot->id == id)
+                {
+                    udp_add(listen_fd, replies, &slot->address, "%llu%s", (unsigned long long)slot->origin_id, reply);
+                    trace_span(slot->trace_id, args->span_name, slot->start, slot->client_id);
+                    slot->id = 0;
+                }
+            }
+        }
+
+        // Send the batches
+        udp_flush(upstream_fd, forwards);
+        udp_flush(listen_fd, replies);
+    }
+    return NULL;
+}
+
+static inline void udp_start(int port, int workers, udp_handler handler, const char *span_name)
+{
+    // Start the workers, each with its own socket on the port
+    static struct udp_worker_args args;
+    args.port = port;
+    args.handler = handler;
+    args.span_name = span_name;
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, udp_worker, &args) != 0)
+        {
+            perror("\nPthread_create failed\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread_id);
+    }
+}
+
+#endif
@@ -1,8 +1,20 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 
 #define LB_PORT "9090"                                                   // Load Balancer port
 char *RP_IDS[] = {"1", "2"};                                             // Reverse Proxy IDs
@@ -16,15 +28,199 @@ pid_t SERVER_PIDS[6]; // Server process IDs
 
 int is_sigterm = 0; // Flag to indicate if SIGTERM signal is received
 
+#define MAX_NODES 64                           // Maximum number of NUMA nodes tracked by the placement policy
+#define NODE_SYSFS_PATH "/sys/devices/system/node" // Location of the NUMA topology in sysfs
+
+// Component roles used by the placement policy
+#define ROLE_LB 0
+#define ROLE_RP 1
+#define ROLE_SERVER 2
+
+cpu_set_t ALL_CPUS;             // CPUs the watchdog is allowed to run on
+cpu_set_t ROLE_CPUS[3];         // CPU sets of the roles (-l, -r, -s)
+int has_role_cpus[3] = {0};     // Flags to indicate if a role has its own CPU set
+cpu_set_t NODE_CPUS[MAX_NODES]; // CPUs of each NUMA node
+int NODE_IDS[MAX_NODES];        // Kernel IDs of each NUMA node
+int node_count = 0;             // Number of known NUMA nodes
+
+int node_local = 0;  // Flag to keep each reverse proxy on the same node as its servers (-n)
+int isolate_lb = 0;  // Flag to dedicate cores to the load balancer (-i)
+int bind_memory = 0; // Flag to bind memory to the nodes of the assigned CPUs (-m)
+int read_sysfs = 0;  // Flag to read the topology from sysfs (-t)
+
+char *TLS_CERT = NULL;    // TLS certificate of the load balancer (-c)
+char *TLS_KEY = NULL;     // TLS private key of the load balancer (-k)
+char *UDP_WORKERS = NULL; // Number of UDP workers per component, NULL for TCP only (-u)
+
+// Rate limit options passed through to the load balancer, NULL for its defaults
+char *RATE_LIMIT = NULL;     // Requests per second of each client (-R)
+char *RATE_BURST = NULL;     // Burst size of each client (-B)
+char *RATE_OVERRIDES = NULL; // File of per-client rates and bursts (-O)
+char *RATE_IDLE = NULL;      // Seconds after which idle clients are forgotten (-E)
+
+#define CHAOS_MAX_KILLS 64           // Maximum number of kills in a chaos schedule
+#define CHAOS_MAX_THREADS 64         // Maximum number of load threads in chaos mode
+#define CHAOS_FIRST_CLIENT_ID 1000   // Client ID of the first load thread; the next ones count up
+#define CHAOS_TIMEOUT 5              // Seconds after which a request of the load is given up
+#define CHAOS_RESTART_TIMEOUT 10     // Seconds to wait for a killed component to accept connections again
+#define CHAOS_PROBE_INTERVAL 100     // Microseconds between checks for a restarted component
+
+// Target of one scheduled kill
+struct chaos_kill
+{
+    char name[16];     // Target as given in the schedule (lb, proxy<N> or server<N>)
+    int role;          // ROLE_LB, ROLE_RP or ROLE_SERVER
+    int index;         // Index of the proxy or server
+    double at;         // Seconds after the load starts
+    uint64_t killed;   // Time of the SIGKILL
+    uint64_t relaunch; // Time the watchdog started the replacement, 0 if it did not
+    uint64_t ready;    // Time the replacement accepted a connection, 0 if it did not
+};
+
+// Results of the requests started in one period: before the first kill (slot 0) or after kill N (slot N + 1)
+struct chaos_period
+{
+    atomic_ulong requests;
+    atomic_ulong failed;      // Requests without a valid result
+    atomic_ulong stalled;     // Requests slower than the stall threshold
+    atomic_ulong first_ok[2]; // Time of the first success started in the period, per proxy path
+    atomic_int restarts;      // Components relaunched by the watchdog
+};
+
+char *CHAOS_SCHEDULE = NULL; // Chaos schedule, NULL for normal operation (-x)
+double chaos_rate = 500;     // Requests per second of the whole load (-q)
+int chaos_threads = 4;       // Number of load threads (-j)
+double chaos_stall = 1000;   // Milliseconds after which a request counts as stalled (-z)
+double chaos_settle = 3;     // Seconds the load keeps running after the last kill (-d)
+
+struct chaos_kill CHAOS_KILLS[CHAOS_MAX_KILLS];
+int chaos_kill_count = 0;
+struct chaos_period CHAOS_PERIODS[CHAOS_MAX_KILLS + 1];
+atomic_int chaos_period = 0; // Period that new requests belong to
+atomic_int chaos_stop = 0;   // Flag to stop the load threads
+
 // Function declarations
 pid_t create_load_balancer();
 pid_t create_reverse_proxy(int);
 pid_t create_server(int);
 void sigchld_handler(int);
 void sigtstp_handler(int);
+void sigusr1_handler(int);
+int parse_cpu_list(const char *, cpu_set_t *);
+void read_topology();
+void apply_placement(int, int);
+int parse_chaos_schedule(const char *);
+int compare_kills(const void *, const void *);
+uint64_t chaos_now();
+void chaos_sleep_until(uint64_t);
+int chaos_request(int);
+void *chaos_load(void *);
+pid_t *chaos_pid(struct chaos_kill *);
+const char *chaos_port(struct chaos_kill *);
+int chaos_probe(const char *);
+void *chaos_run(void *);
+void chaos_report(uint64_t);
+void usage(const char *);
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Parse placement policy options
+    int opt;
+    while ((opt = getopt(argc, argv, "l:r:s:nimtc:k:u:R:B:O:E:x:q:j:z:d:")) != -1)
+    {
+        int role = -1;
+        switch (opt)
+        {
+        case 'l':
+            role = ROLE_LB;
+            break;
+        case 'r':
+            role = ROLE_RP;
+            break;
+        case 's':
+            role = ROLE_SERVER;
+            break;
+        case 'n':
+            node_local = 1;
+            break;
+        case 'i':
+            isolate_lb = 1;
+            break;
+        case 'm':
+            bind_memory = 1;
+            break;
+        case 't':
+            read_sysfs = 1;
+            break;
+        case 'c':
+            TLS_CERT = optarg;
+            break;
+        case 'k':
+            TLS_KEY = optarg;
+            break;
+        case 'u':
+            UDP_WORKERS = optarg;
+            break;
+        case 'R':
+            RATE_LIMIT = optarg;
+            break;
+        case 'B':
+            RATE_BURST = optarg;
+            break;
+        case 'O':
+            RATE_OVERRIDES = optarg;
+            break;
+        case 'E':
+            RATE_IDLE = optarg;
+            break;
+        case 'x':
+            CHAOS_SCHEDULE = optarg;
+            break;
+        case 'q':
+            chaos_rate = atof(optarg);
+            break;
+        case 'j':
+            chaos_threads = atoi(optarg);
+            break;
+        case 'z':
+            chaos_stall = atof(optarg);
+            break;
+        case 'd':
+            chaos_settle = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+
+        // Store the CPU set of the role
+        if (role >= 0)
+        {
+            if (parse_cpu_list(optarg, &ROLE_CPUS[role]) < 0)
+            {
+                fprintf(stderr, "[WATCHDOG]: Invalid CPU list '%s'.\n", optarg);
+                usage(argv[0]);
+            }
+            has_role_cpus[role] = 1;
+        }
+    }
+
+    // Check the chaos benchmark settings
+    if (CHAOS_SCHEDULE != NULL && (parse_chaos_schedule(CHAOS_SCHEDULE) < 0 || chaos_rate <= 0 || chaos_threads <= 0 || chaos_threads > CHAOS_MAX_THREADS))
+    {
+        fprintf(stderr, "[WATCHDOG]: Invalid chaos schedule '%s'.\n", CHAOS_SCHEDULE);
+        usage(argv[0]);
+    }
+
+    // The chaos load is plaintext and counts every rate limit rejection as a failure
+    if (CHAOS_SCHEDULE != NULL && (TLS_CERT != NULL || RATE_LIMIT != NULL || RATE_OVERRIDES != NULL))
+    {
+        fprintf(stderr, "[WATCHDOG]: The chaos benchmark cannot be combined with -c, -R or -O.\n");
+        usage(argv[0]);
+    }
+
+    // Discover the CPUs and NUMA nodes used by the placement policy
+    read_topology();
+
     printf("[WATCHDOG]: Watchdog has started.\n");
 
     // Install SIGCHLD handler
@@ -33,6 +229,9 @@ int main()
     // Install SIGTSTP handler
     signal(SIGTSTP, sigtstp_handler);
 
+    // Install SIGUSR1 handler to dump the request traces of all components
+    signal(SIGUSR1, sigusr1_handler);
+
     // Create Load Balancer, Reverse Proxies, and Servers
     LB_PID = create_load_balancer();
     RP_PIDS[0] = create_reverse_proxy(0);
@@ -44,9 +243,28 @@ int main()
     SERVER_PIDS[4] = create_server(4);
     SERVER_PIDS[5] = create_server(5);
 
-    // Infinite loop to keep the program running
+    // Run the chaos benchmark in its own thread, leaving the signals to this one
+    if (CHAOS_SCHEDULE != NULL)
+    {
+        sigset_t signals, previous;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGCHLD);
+        sigaddset(&signals, SIGTSTP);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, &previous);
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, chaos_run, NULL) != 0)
+        {
+            perror("\nPthread_create failed\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread_id);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    }
+
+    // Sleep until a signal arrives to keep the program running
     while (1)
-        ;
+        pause();
 
     return 0;
 }
@@ -57,8 +275,44 @@ pid_t create_load_balancer()
     pid_t pid = fork(); // Fork a new process
     if (pid == 0)
     {
-        // Child process: execute load balancer
-        char *argv[] = {"./load_balancer", LB_PORT, RP_IDS[0], RP_IDS[1], RP_PORTS[0], RP_PORTS[1], NULL};
+        // Child process: apply placement and execute load balancer
+        apply_placement(ROLE_LB, 0);
+        char *argv[21] = {"./load_balancer"};
+        int argc = 1;
+
+        // Enable TLS termination if a certificate is given
+        if (TLS_CERT != NULL)
+        {
+            argv[argc++] = "-c";
+            argv[argc++] = TLS_CERT;
+            argv[argc++] = "-k";
+            argv[argc++] = TLS_KEY != NULL ? TLS_KEY : TLS_CERT;
+        }
+
+        // Enable the UDP fast path if requested
+        if (UDP_WORKERS != NULL)
+        {
+            argv[argc++] = "-u";
+            argv[argc++] = UDP_WORKERS;
+        }
+
+        // Pass the rate limit options through
+        char *rate_options[] = {"-R", RATE_LIMIT, "-B", RATE_BURST, "-O", RATE_OVERRIDES, "-E", RATE_IDLE};
+        for (int i = 0; i < 8; i += 2)
+        {
+            if (rate_options[i + 1] != NULL)
+            {
+                argv[argc++] = rate_options[i];
+                argv[argc++] = rate_options[i + 1];
+            }
+        }
+
+        // Options go before the positional arguments, which POSIX getopt stops at
+        char *arguments[] = {LB_PORT, RP_IDS[0], RP_IDS[1], RP_PORTS[0], RP_PORTS[1]};
+        for (int i = 0; i < 5; i++)
+        {
+            argv[argc++] = arguments[i];
+        }
         execv("./load_balancer", argv);
     }
     return pid; // Return the process ID of the load balancer
@@ -70,8 +324,24 @@ pid_t create_reverse_proxy(int rp_index)
     pid_t pid = fork(); // Fork a new process
     if (pid == 0)
     {
-        // Child process: execute reverse proxy
-        char *argv[] = {"./reverse_proxy", RP_IDS[rp_index], RP_PORTS[rp_index], SERVER_IDS[3 * rp_index + 0], SERVER_IDS[3 * rp_index + 1], SERVER_IDS[3 * rp_index + 2], SERVER_PORTS[3 * rp_index + 0], SERVER_PORTS[3 * rp_index + 1], SERVER_PORTS[3 * rp_index + 2], NULL};
+        // Child process: apply placement and execute reverse proxy
+        apply_placement(ROLE_RP, rp_index);
+        char *argv[12] = {"./reverse_proxy"};
+        int argc = 1;
+
+        // Enable the UDP fast path if requested
+        if (UDP_WORKERS != NULL)
+        {
+            argv[argc++] = "-u";
+            argv[argc++] = UDP_WORKERS;
+        }
+
+        // Options go before the positional arguments, which POSIX getopt stops at
+        char *arguments[] = {RP_IDS[rp_index], RP_PORTS[rp_index], SERVER_IDS[3 * rp_index + 0], SERVER_IDS[3 * rp_index + 1], SERVER_IDS[3 * rp_index + 2], SERVER_PORTS[3 * rp_index + 0], SERVER_PORTS[3 * rp_index + 1], SERVER_PORTS[3 * rp_index + 2]};
+        for (int i = 0; i < 8; i++)
+        {
+            argv[argc++] = arguments[i];
+        }
         execv("./reverse_proxy", argv);
     }
     return pid; // Return the process ID of the reverse proxy
@@ -83,8 +353,21 @@ pid_t create_server(int server_index)
     pid_t pid = fork(); // Fork a new process
     if (pid == 0)
     {
-        // Child process: execute server
-        char *argv[] = {"./server", SERVER_IDS[server_index], SERVER_PORTS[server_index], NULL};
+        // Child process: apply placement and execute server
+        apply_placement(ROLE_SERVER, server_index);
+        char *argv[6] = {"./server"};
+        int argc = 1;
+
+        // Enable the UDP fast path if requested
+        if (UDP_WORKERS != NULL)
+        {
+            argv[argc++] = "-u";
+            argv[argc++] = UDP_WORKERS;
+        }
+
+        // Options go before the positional arguments, which POSIX getopt stops at
+        argv[argc++] = SERVER_IDS[server_index];
+        argv[argc++] = SERVER_PORTS[server_index];
         execv("./server", argv);
     }
     return pid; // Return the process ID of the server
@@ -102,6 +385,9 @@ void sigchld_handler(int signo)
 
         if (failed_pid > 0)
         {
+            // Count the relaunch for the chaos benchmark
+            atomic_fetch_add(&CHAOS_PERIODS[atomic_load(&chaos_period)].restarts, 1);
+
             // Relaunch Load Balancer if it failed
             if (failed_pid == LB_PID)
             {
@@ -171,3 +457,536 @@ void sigtstp_handler(int signo)
     printf("[WATCHDOG]: All processes terminated. Exiting...\n");
     exit(EXIT_SUCCESS);
 }
+
+void sigusr1_handler(int signo)
+{
+    // Ask every component to dump its request traces
+    printf("[WATCHDOG]: Received SIGUSR1. Dumping request traces...\n");
+    kill(LB_PID, SIGUSR1);
+    for (int i = 0; i < 2; i++)
+    {
+        kill(RP_PIDS[i], SIGUSR1);
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        kill(SERVER_PIDS[i], SIGUSR1);
+    }
+}
+
+int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    // Parse a CPU list such as "0-3,8,10-11" into a CPU set
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+        {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+            {
+                return -1;
+            }
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+        p = end;
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0' && *p != '\n')
+        {
+            return -1;
+        }
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+void read_topology()
+{
+    // Start from the CPUs the watchdog itself may use
+    if (sched_getaffinity(0, sizeof(ALL_CPUS), &ALL_CPUS) < 0)
+    {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+
+    // Read the CPU list of every node from sysfs if requested; -n and -m need the real topology
+    read_sysfs = read_sysfs || node_local || bind_memory;
+    DIR *dir = read_sysfs ? opendir(NODE_SYSFS_PATH) : NULL;
+    if (read_sysfs && dir == NULL)
+    {
+        perror("opendir " NODE_SYSFS_PATH);
+    }
+    if (dir != NULL)
+    {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL && node_count < MAX_NODES)
+        {
+            int node_id;
+            char trailing;
+            if (sscanf(entry->d_name, "node%d%c", &node_id, &trailing) != 1 || node_id >= MAX_NODES)
+            {
+                continue;
+            }
+
+            char path[300];
+            char list[4096];
+            snprintf(path, sizeof(path), "%s/%s/cpulist", NODE_SYSFS_PATH, entry->d_name);
+            FILE *file = fopen(path, "r");
+            if (file == NULL)
+            {
+                continue;
+            }
+            int ok = fgets(list, sizeof(list), file) != NULL;
+            fclose(file);
+
+            // Memory-only nodes have an empty CPU list and cannot host components
+            cpu_set_t cpus;
+            if (!ok || parse_cpu_list(list, &cpus) < 0)
+            {
+                continue;
+            }
+            CPU_AND(&NODE_CPUS[node_count], &cpus, &ALL_CPUS);
+            if (CPU_COUNT(&NODE_CPUS[node_count]) == 0)
+            {
+                continue;
+            }
+            NODE_IDS[node_count] = node_id;
+            node_count++;
+        }
+        closedir(dir);
+
+        // Order the nodes by ID, since sysfs lists them in hash order
+        for (int i = 1; i < node_count; i++)
+        {
+            cpu_set_t cpus = NODE_CPUS[i];
+            int node_id = NODE_IDS[i];
+            int j = i;
+            for (; j > 0 && NODE_IDS[j - 1] > node_id; j--)
+            {
+                NODE_CPUS[j] = NODE_CPUS[j - 1];
+                NODE_IDS[j] = NODE_IDS[j - 1];
+            }
+            NODE_CPUS[j] = cpus;
+            NODE_IDS[j] = node_id;
+        }
+    }
+
+    // Fall back to a single node holding all CPUs
+    if (node_count == 0)
+    {
+        // Binding every component to a made-up node 0 would put all memory on one node
+        if (bind_memory)
+        {
+            fprintf(stderr, "[WATCHDOG]: No NUMA topology found. Not binding memory (-m).\n");
+            bind_memory = 0;
+        }
+        NODE_CPUS[0] = ALL_CPUS;
+        NODE_IDS[0] = 0;
+        node_count = 1;
+    }
+
+    // Dedicate the last allowed CPU to the load balancer if no CPU set is given
+    if (isolate_lb && !has_role_cpus[ROLE_LB])
+    {
+        CPU_ZERO(&ROLE_CPUS[ROLE_LB]);
+        for (int cpu = CPU_SETSIZE - 1; cpu >= 0; cpu--)
+        {
+            if (CPU_ISSET(cpu, &ALL_CPUS))
+            {
+                CPU_SET(cpu, &ROLE_CPUS[ROLE_LB]);
+                break;
+            }
+        }
+        has_role_cpus[ROLE_LB] = 1;
+    }
+}
+
+void apply_placement(int role, int index)
+{
+    // Nothing to do if no placement policy is requested
+    if (!has_role_cpus[role] && !node_local && !isolate_lb && !bind_memory)
+    {
+        return;
+    }
+
+    // Start from the CPU set of the role
+    cpu_set_t mask = has_role_cpus[role] ? ROLE_CPUS[role] : ALL_CPUS;
+    cpu_set_t narrowed;
+
+    // Keep a reverse proxy and its three servers on the same node
+    if (node_local && role != ROLE_LB)
+    {
+        int group = role == ROLE_RP ? index : index / 3;
+        cpu_set_t *node_cpus = &NODE_CPUS[group % node_count];
+        CPU_AND(&narrowed, &mask, node_cpus);
+        mask = CPU_COUNT(&narrowed) > 0 ? narrowed : *node_cpus;
+    }
+
+    // Keep other components off the load balancer cores
+    if (isolate_lb && role != ROLE_LB)
+    {
+        CPU_XOR(&narrowed, &mask, &ROLE_CPUS[ROLE_LB]);
+        CPU_AND(&narrowed, &narrowed, &mask);
+        if (CPU_COUNT(&narrowed) > 0)
+        {
+            mask = narrowed;
+        }
+        else
+        {
+            fprintf(stderr, "[WATCHDOG]: No CPU left outside the load balancer cores. Sharing them.\n");
+        }
+    }
+
+    // Pin the process to the selected CPUs
+    if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+    {
+        perror("sched_setaffinity");
+    }
+
+    // Bind memory allocations to the nodes of the selected CPUs
+    if (bind_memory)
+    {
+        unsigned long nodemask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        for (int i = 0; i < node_count; i++)
+        {
+            CPU_AND(&narrowed, &mask, &NODE_CPUS[i]);
+            if (CPU_COUNT(&narrowed) > 0)
+            {
+                nodemask[NODE_IDS[i] / (8 * sizeof(unsigned long))] |= 1UL << (NODE_IDS[i] % (8 * sizeof(unsigned long)));
+            }
+        }
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, nodemask, MAX_NODES + 1) < 0)
+        {
+            perror("set_mempolicy");
+        }
+    }
+}
+
+int parse_chaos_schedule(const char *schedule)
+{
+    // Parse "<target>@<seconds>" entries separated by commas, e.g. "server1@2,proxy2@5,lb@8"
+    char copy[1024];
+    snprintf(copy, sizeof(copy), "%s", schedule);
+    char *saveptr;
+    for (char *entry = strtok_r(copy, ",", &saveptr); entry != NULL; entry = strtok_r(NULL, ",", &saveptr))
+    {
+        if (chaos_kill_count == CHAOS_MAX_KILLS)
+        {
+            return -1;
+        }
+        struct chaos_kill *k = &CHAOS_KILLS[chaos_kill_count];
+        memset(k, 0, sizeof(*k));
+        int id = 0;
+        if (sscanf(entry, "%15[^@]@%lf", k->name, &k->at) != 2 || k->at < 0)
+        {
+            return -1;
+        }
+        if (strcmp(k->name, "lb") == 0)
+        {
+            k->role = ROLE_LB;
+        }
+        else if (sscanf(k->name, "proxy%d", &id) == 1 && id >= 1 && id <= 2)
+        {
+            k->role = ROLE_RP;
+            k->index = id - 1;
+        }
+        else if (sscanf(k->name, "server%d", &id) == 1 && id >= 1 && id <= 6)
+        {
+            k->role = ROLE_SERVER;
+            k->index = id - 1;
+        }
+        else
+        {
+            return -1;
+        }
+        chaos_kill_count++;
+    }
+
+    // Kill in the order of the schedule
+    qsort(CHAOS_KILLS, chaos_kill_count, sizeof(struct chaos_kill), compare_kills);
+    return chaos_kill_count > 0 ? 0 : -1;
+}
+
+int compare_kills(const void *a, const void *b)
+{
+    // Order kills by time
+    double x = ((const struct chaos_kill *)a)->at;
+    double y = ((const struct chaos_kill *)b)->at;
+    return (x > y) - (x < y);
+}
+
+uint64_t chaos_now()
+{
+    // Monotonic time in microseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void chaos_sleep_until(uint64_t time)
+{
+    // Sleep until a monotonic time in microseconds
+    struct timespec ts = {time / 1000000, (time % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    {
+    }
+}
+
+int chaos_request(int client_id)
+{
+    // Connect to the load balancer, giving up on requests slower than CHAOS_TIMEOUT
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_fd < 0)
+    {
+        return 0;
+    }
+    struct timeval timeout = {CHAOS_TIMEOUT, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(LB_PORT));
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    if (connect(client_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(client_fd);
+        return 0;
+    }
+
+    // Send a request and accept only a square root as the result
+    char request[32];
+    char buffer[80];
+    snprintf(request, sizeof(request), "%d 2", client_id);
+    ssize_t byte_length = -1;
+    if (send(client_fd, request, strlen(request), MSG_NOSIGNAL) > 0)
+    {
+        byte_length = read(client_fd, buffer, sizeof(buffer) - 1);
+    }
+    close(client_fd);
+    return byte_length > 0 && buffer[0] >= '0' && buffer[0] <= '9';
+}
+
+void *chaos_load(void *arg)
+{
+    // Each thread sends its share of the rate as one client, spread evenly over time
+    int thread_index = (int)(intptr_t)arg;
+    int client_id = CHAOS_FIRST_CLIENT_ID + thread_index;
+    int path = client_id % 2 == 0 ? 1 : 0; // Proxy chosen by the load balancer for this client
+    uint64_t interval = (uint64_t)(chaos_threads * 1000000.0 / chaos_rate);
+    uint64_t next = chaos_now() + interval * thread_index / chaos_threads;
+
+    while (!atomic_load(&chaos_stop))
+    {
+        // Keep the pace without catching up on requests that were late
+        chaos_sleep_until(next);
+        uint64_t start = chaos_now();
+        next = next + interval > start ? next + interval : start;
+
+        // Send a request and record its outcome in the period it started in
+        struct chaos_period *period = &CHAOS_PERIODS[atomic_load(&chaos_period)];
+        int ok = chaos_request(client_id);
+        uint64_t end = chaos_now();
+        atomic_fetch_add(&period->requests, 1);
+        if (!ok)
+        {
+            atomic_fetch_add(&period->failed, 1);
+        }
+        if (end - start > chaos_stall * 1000)
+        {
+            atomic_fetch_add(&period->stalled, 1);
+        }
+        unsigned long none = 0;
+        if (ok)
+        {
+            atomic_compare_exchange_strong(&period->first_ok[path], &none, end);
+        }
+    }
+    return NULL;
+}
+
+pid_t *chaos_pid(struct chaos_kill *k)
+{
+    // Process ID variable of the target, updated by the watchdog on relaunch
+    if (k->role == ROLE_LB)
+    {
+        return &LB_PID;
+    }
+    return k->role == ROLE_RP ? &RP_PIDS[k->index] : &SERVER_PIDS[k->index];
+}
+
+const char *chaos_port(struct chaos_kill *k)
+{
+    // Port of the target
+    if (k->role == ROLE_LB)
+    {
+        return LB_PORT;
+    }
+    return k->role == ROLE_RP ? RP_PORTS[k->index] : SERVER_PORTS[k->index];
+}
+
+int chaos_probe(const char *port)
+{
+    // Check whether a component accepts connections
+    int probe_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(port));
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    int connected = connect(probe_fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    close(probe_fd);
+    return connected;
+}
+
+void *chaos_run(void *arg)
+{
+    // Wait until both proxy paths answer
+    uint64_t deadline = chaos_now() + CHAOS_RESTART_TIMEOUT * 1000000ULL;
+    while (!chaos_request(CHAOS_FIRST_CLIENT_ID) || !chaos_request(CHAOS_FIRST_CLIENT_ID + 1))
+    {
+        if (chaos_now() > deadline)
+        {
+            fprintf(stderr, "[CHAOS]: The system did not answer within %d seconds.\n", CHAOS_RESTART_TIMEOUT);
+            kill(getpid(), SIGTSTP);
+            return NULL;
+        }
+        usleep(10000);
+    }
+
+    // Start the steady load
+    pthread_t threads[CHAOS_MAX_THREADS];
+    for (int i = 0; i < chaos_threads; i++)
+    {
+        pthread_create(&threads[i], NULL, chaos_load, (void *)(intptr_t)i);
+    }
+    uint64_t start = chaos_now();
+
+    for (int i = 0; i < chaos_kill_count; i++)
+    {
+        struct chaos_kill *k = &CHAOS_KILLS[i];
+        chaos_sleep_until(start + (uint64_t)(k->at * 1000000));
+
+        // Kill the target and start a new period for the requests that follow
+        volatile pid_t *pid = chaos_pid(k);
+        pid_t victim = *pid;
+        k->killed = chaos_now();
+        atomic_store(&chaos_period, i + 1);
+        kill(victim, SIGKILL);
+
+        // Wait for the watchdog to relaunch it and for the replacement to accept connections
+        deadline = k->killed + CHAOS_RESTART_TIMEOUT * 1000000ULL;
+        while (*pid == victim && chaos_now() < deadline)
+        {
+            usleep(CHAOS_PROBE_INTERVAL);
+        }
+        if (*pid == victim)
+        {
+            continue;
+        }
+        k->relaunch = chaos_now();
+        while (!chaos_probe(chaos_port(k)) && chaos_now() < deadline)
+        {
+            usleep(CHAOS_PROBE_INTERVAL);
+        }
+        if (chaos_now() < deadline)
+        {
+            k->ready = chaos_now();
+        }
+    }
+
+    // Let the system settle, stop the load and shut everything down
+    usleep((useconds_t)(chaos_settle * 1000000));
+    atomic_store(&chaos_stop, 1);
+    for (int i = 0; i < chaos_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    chaos_report(start);
+    kill(getpid(), SIGTSTP);
+    return NULL;
+}
+
+void chaos_report(uint64_t start)
+{
+    // Print one line per period to stderr, so that it stands out from the component logs
+    fprintf(stderr, "[CHAOS]: %d threads, %.0f requests/s, stalled after %.0f ms\n", chaos_threads, chaos_rate, chaos_stall);
+    fprintf(stderr, "[CHAOS]: %-9s %8s %13s %10s %13s %9s %7s %8s %9s\n", "kill", "at (s)", "relaunch (ms)", "ready (ms)", "first ok (ms)", "requests", "failed", "stalled", "restarts");
+    for (int i = 0; i <= chaos_kill_count; i++)
+    {
+        struct chaos_period *period = &CHAOS_PERIODS[i];
+        char at[16] = "-", relaunch[16] = "-", ready[16] = "-", first_ok[16] = "-";
+        if (i > 0)
+        {
+            // Time from the kill to the relaunch, to accepting connections and to the first success on the path of the target
+            struct chaos_kill *k = &CHAOS_KILLS[i - 1];
+            uint64_t ok[2] = {atomic_load(&period->first_ok[0]), atomic_load(&period->first_ok[1])};
+            uint64_t first = k->role == ROLE_LB ? (ok[0] != 0 && (ok[1] == 0 || ok[0] < ok[1]) ? ok[0] : ok[1]) : ok[k->role == ROLE_RP ? k->index : k->index / 3];
+            snprintf(at, sizeof(at), "%.3f", (k->killed - start) / 1e6);
+            if (k->relaunch != 0)
+            {
+                snprintf(relaunch, sizeof(relaunch), "%.2f", (k->relaunch - k->killed) / 1e3);
+            }
+
+            // A success through the load balancer or proxy also shows that it is ready, and may come first when the probe is not scheduled
+            uint64_t ready_time = k->ready;
+            if (k->relaunch != 0 && k->role != ROLE_SERVER && first != 0 && (ready_time == 0 || first < ready_time))
+            {
+                ready_time = first;
+            }
+            if (ready_time != 0)
+            {
+                snprintf(ready, sizeof(ready), "%.2f", (ready_time - k->killed) / 1e3);
+            }
+            if (first != 0)
+            {
+                snprintf(first_ok, sizeof(first_ok), "%.2f", (first - k->killed) / 1e3);
+            }
+        }
+        fprintf(stderr, "[CHAOS]: %-9s %8s %13s %10s %13s %9lu %7lu %8lu %9d\n", i == 0 ? "baseline" : CHAOS_KILLS[i - 1].name, at, relaunch, ready, first_ok,
+                atomic_load(&period->requests), atomic_load(&period->failed), atomic_load(&period->stalled), atomic_load(&period->restarts));
+    }
+}
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-l cpus] [-r cpus] [-s cpus] [-n] [-i] [-m] [-t] [-c cert -k key] [-u workers] [-R rate] [-B burst] [-O file] [-E seconds]\n"
+                    "          [-x schedule [-q rate] [-j threads] [-z ms] [-d seconds]]\n", program);
+    fprintf(stderr, "  -l cpus  CPU list of the load balancer (e.g. 0-1,4)\n");
+    fprintf(stderr, "  -r cpus  CPU list of the reverse proxies\n");
+    fprintf(stderr, "  -s cpus  CPU list of the servers\n");
+    fprintf(stderr, "  -n       keep each reverse proxy on the same node as its servers (implies -t)\n");
+    fprintf(stderr, "  -i       dedicate the load balancer cores to the load balancer\n");
+    fprintf(stderr, "  -m       bind memory to the nodes of the assigned CPUs (implies -t)\n");
+    fprintf(stderr, "  -t       read the NUMA topology from " NODE_SYSFS_PATH "\n");
+    fprintf(stderr, "  -c cert  terminate TLS at the load balancer with this certificate\n");
+    fprintf(stderr, "  -k key   private key of the TLS certificate\n");
+    fprintf(stderr, "  -u n     serve UDP next to TCP with n workers per component\n");
+    fprintf(stderr, "  -R rate  limit each client to rate requests per second at the load balancer\n");
+    fprintf(stderr, "  -B n     let each client burst up to n requests\n");
+    fprintf(stderr, "  -O file  per-client \"<client_id> <rate> <burst>\" lines overriding -R and -B\n");
+    fprintf(stderr, "  -E secs  forget clients idle for secs seconds (default 60)\n");
+    fprintf(stderr, "  -x list  chaos benchmark: SIGKILL targets under load, e.g. server1@2,proxy2@5,lb@8\n");
+    fprintf(stderr, "  -q rate  requests per second of the chaos load (default 500)\n");
+    fprintf(stderr, "  -j n     number of chaos load threads, one client ID each (default 4)\n");
+    fprintf(stderr, "  -z ms    count chaos requests slower than ms as stalled (default 1000)\n");
+    fprintf(stderr, "  -d secs  keep the chaos load running secs seconds after the last kill (default 3)\n");
+    exit(EXIT_FAILURE);
+}